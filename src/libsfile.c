@@ -0,0 +1,4285 @@
+/*
+ *  sfile
+ *  src/libsfile.c
+ *
+ *  Author: Vilmain Nicolas
+ *  Contact: nicolas.vilmain@gmail.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include  <time.h>
+#include  <math.h>
+#include  <errno.h>
+#include  <stdio.h>
+#include  <ctype.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <dirent.h>
+#include  <fcntl.h>
+#include  <unistd.h>
+#include  <sys/mman.h>
+#include  <sys/stat.h>
+#include  <sys/resource.h>
+#ifdef __SSE2__
+# include  <emmintrin.h>
+#endif /* __SSE2__ */
+#ifdef MACOS
+# include <sys/param.h>
+# include <sys/mount.h>
+#else
+# include <sys/vfs.h>
+# include <sys/syscall.h>
+# include <sys/sysmacros.h>
+#endif /* MACOS */
+#include  "libsfile.h"
+#include  "libsfile_fold.h"
+
+/* append new chunk to stack */
+#define APPENDTOSTACK(stack, new)       \
+  do {                                  \
+      new->next = NULL;                 \
+      if (stack->chunk)                 \
+          stack->tail->next = new;      \
+      else                              \
+          stack->chunk = new;           \
+      stack->tail = new;                \
+    }  while (0)
+
+#ifdef SFILE_USDT
+# include <sys/sdt.h>
+# define SFILE_PROBE(name, arg) DTRACE_PROBE1(sfile, name, arg)
+#else
+# define SFILE_PROBE(name, arg) do { } while (0)
+#endif /* SFILE_USDT */
+
+/*
+ * Trace point: USDT probes sfile:name-start and sfile:name-done
+ * (make USDT=yes) and --trace event.
+ */
+#define TRACE_BEGIN(x, name, arg, t)           \
+  do {                                         \
+      SFILE_PROBE(name##__start, arg);         \
+      (t) = trace_begin(x);                    \
+    } while (0)
+
+#define TRACE_END(x, name, arg, t)             \
+  do {                                         \
+      SFILE_PROBE(name##__done, arg);          \
+      trace_end(x, #name, arg, t);             \
+    } while (0)
+
+/* bounded queue of paths shared by the workers */
+struct queue_s {
+    struct sfile_ctx_s *x;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    void **items;
+    size_t size;
+    size_t head;
+    size_t count;
+    int closed;
+};
+
+/* --trace state, events are written by the flusher thread */
+struct sfile_trace_s {
+    int fd;
+    int closed;
+    int n_tid;
+    long pid;
+    double t0;
+    pthread_mutex_t lock;        /* full, closed and n_tid */
+    pthread_mutex_t write_lock;  /* fd */
+    pthread_cond_t cond;
+    pthread_t flusher;
+    struct trace_buf_s *full;    /* buffers to write, first in, first out */
+    struct trace_buf_s *full_tail;
+};
+
+struct trace_buf_s {
+    size_t len;
+    struct trace_buf_s *next;
+    char data[SFILE_TRACE_BUFSIZE];
+};
+
+/* events of one thread, one traced context at a time by thread */
+struct trace_thread_s {
+    struct sfile_trace_s *t;
+    int tid;
+    struct trace_buf_s *buf;
+    char *ev;         /* event being formatted */
+    size_t ev_len;
+    size_t ev_size;
+};
+
+static _Thread_local struct trace_thread_s *trace_self;
+
+/* code point of a byte not in a valid UTF-8 sequence */
+#define FOLD_INVALID(c) (0x110000 + (uint32_t) (c))
+
+/*
+ * Case insensitive needle (-C, --ign-case-*), folded once: its code
+ * points folded, and the first bytes of the texts that can match it.
+ */
+struct sfile_fold_s {
+    uint32_t *cp;
+    size_t n_cp;
+    size_t max_len;             /* bytes of the longest match */
+    unsigned char lead[256];    /* 1 for a first byte of a match */
+    unsigned char ascii[2];     /* ASCII first bytes, for the block scan */
+};
+
+/* --fuzzy-name: bitap masks and the best results */
+struct sfile_fuzzy_s {
+    uint64_t mask[256];
+    size_t len;
+    struct fuzzy_entry_s {
+        int dist;
+        int depth;
+        char *path;
+        enum file_type_e type;
+        struct stat st;
+    } *heap;             /* worst result first */
+    size_t count;
+    size_t size;
+};
+
+/* cachestat() of Linux 6.5, not in all libc headers */
+#if defined(SYS_cachestat)
+# define SFILE_SYS_CACHESTAT SYS_cachestat
+#elif defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+# define SFILE_SYS_CACHESTAT 451
+#endif
+
+#ifdef SFILE_SYS_CACHESTAT
+struct cache_range_s {
+    uint64_t off;
+    uint64_t len;
+};
+
+struct cache_stat_s {
+    uint64_t nr_cache;
+    uint64_t nr_dirty;
+    uint64_t nr_writeback;
+    uint64_t nr_evicted;
+    uint64_t nr_recently_evicted;
+};
+#endif /* SFILE_SYS_CACHESTAT */
+
+/* --cache-first: file not in page cache, checked by a cold reader */
+struct cold_entry_s {
+    int fd;                  /* opened by file_cached() */
+    char *path;
+    size_t root;
+    enum file_type_e type;
+    struct stat st;
+    struct cold_entry_s *next;
+};
+
+struct sfile_cold_s {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;     /* entry added or closed */
+    struct cold_entry_s *head;
+    struct cold_entry_s *tail;
+    size_t count;
+    size_t max;              /* SFILE_COLD_QUEUE, less if few fds */
+    int closed;
+    int n_threads;           /* started by the first cold file */
+    int no_reader;           /* no thread started, search inline */
+    pthread_t *threads;
+    struct sfile_ctx_s *x;
+};
+
+/* --summary: rows by directory, open addressing (dir NULL if free) */
+struct summary_table_s {
+    struct sfile_summary_s *rows;
+    size_t count;
+    size_t size;
+};
+
+/* totals of the threads, merged at their end */
+struct sfile_sums_s {
+    pthread_mutex_t lock;
+    struct summary_table_s total;
+};
+
+/* accumulators of one thread, one by summarized context */
+struct summary_thread_s {
+    struct sfile_sums_s *s;
+    struct summary_table_s table;
+    struct summary_thread_s *next;
+};
+
+static _Thread_local struct summary_thread_s *summary_self;
+
+/* values of an entry for --estimate */
+enum sample_value_e {
+    SV_ENTRIES,
+    SV_BYTES,
+    SV_RESULTS,
+    SV_MATCHES,
+    SV_COUNT
+};
+
+/*
+ * --estimate: a probe is a random descent from the scanned directory,
+ * each directory checks SFILE_SAMPLE_ENTRIES of its entries (reservoir)
+ * with the weight of the entries they stand for.
+ */
+struct sfile_sample_s {
+    uint64_t rand;               /* xorshift64* state */
+    double weight;               /* of the entry checked */
+    double *acc;                 /* probe, else total (not a directory) */
+    double probe[SV_COUNT];
+    double mean[SV_COUNT];       /* of the probes of the scanned path */
+    double m2[SV_COUNT];
+    double total[SV_COUNT];      /* of all scanned paths */
+    double var[SV_COUNT];
+    char *names[SFILE_SAMPLE_ENTRIES];
+    unsigned long n_probes;
+    unsigned long n_dirs;
+    unsigned long n_checked;
+    double start;
+};
+
+/*
+ * --follow: a directory in scan and its parents, a directory found
+ * again in this chain is a loop. A node is kept by its queued or
+ * scanned directory and by each of its child nodes.
+ */
+struct ancestor_s {
+    dev_t dev;
+    ino_t ino;
+    size_t refs;
+    struct ancestor_s *parent;
+};
+
+/* directory waiting in the list of a walk */
+struct walk_dir_s {
+    char *path;
+    struct ancestor_s *anc;         /* NULL without --follow */
+};
+
+/* entries of one directory for --inode-order */
+struct batch_s {
+    struct batch_entry_s {
+        ino_t ino;
+        size_t name;      /* offset in names */
+        int stat_ok;
+        int rank;         /* --first-fast: 0 if the name matches */
+        struct stat st;
+    } *ent;
+    size_t count;
+    size_t size;
+    char *names;
+    size_t names_len;
+    size_t names_size;
+};
+
+/* state of one recursive scan (or of one scheduler worker) */
+struct walk_s {
+    char *path;                     /* directory in scan, then entry name */
+    size_t path_len;                /* length of the directory part */
+    size_t path_size;
+    dev_t root_dev;
+    size_t root_len;                /* length of the scanned path */
+    struct stack_s dlist;
+    struct ancestor_s *anc;         /* of the directory in scan */
+    pthread_mutex_t *anc_lock;      /* NULL if anc is not shared */
+    struct batch_s batch;
+    struct sched_s *sched;          /* NULL: push directories in dlist */
+};
+
+/* directory waiting in the queue of its device */
+struct sched_dir_s {
+    char *path;
+    dev_t root_dev;
+    size_t root_len;
+    struct ancestor_s *anc;
+    struct sched_dir_s *next;
+};
+
+/* one device, with its queue and its threads */
+struct sched_dev_s {
+    dev_t dev;
+    int n_jobs;
+    struct sched_dir_s *head;
+    struct sched_dir_s *tail;
+    pthread_cond_t cond;
+    struct sched_s *s;
+};
+
+/*
+ * Per device scheduler: directories are scanned by the threads
+ * of their device (st_dev), so each disk works at its own pace.
+ */
+struct sched_s {
+    struct sfile_ctx_s *x;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    struct sched_dev_s **devs;
+    size_t n_devs;
+    pthread_t *threads;
+    size_t n_threads;
+    size_t pending;   /* directories queued or in scan */
+    int closed;       /* all the roots pushed */
+};
+
+#ifndef MACOS
+/* file system names for --skip-fstype, statfs() f_type on Linux */
+static const struct fstype_s {
+    const char *name;
+    long magic;
+} tab_fstype[] = {
+    {"proc", 0x9fa0},
+    {"sysfs", 0x62656572},
+    {"devpts", 0x1cd1},
+    {"tmpfs", 0x01021994},
+    {"cgroup", 0x27e0eb},
+    {"cgroup2", 0x63677270},
+    {"debugfs", 0x64626720},
+    {"tracefs", 0x74726163},
+    {"securityfs", 0x73636673},
+    {"bpf", 0xcafe4a11},
+    {"autofs", 0x0187},
+    {"fuse", 0x65735546},
+    {"fusectl", 0x65735543},
+    {"nfs", 0x6969},
+    {"cifs", 0xff534d42},
+    {"smb2", 0xfe534d42},
+    {"ceph", 0x00c36400},
+    {"9p", 0x01021997},
+    {"overlay", 0x794c7630},
+    {"squashfs", 0x73717368},
+    {"iso9660", 0x9660},
+    {"ext4", 0xef53},
+    {"xfs", 0x58465342},
+    {"btrfs", 0x9123683e},
+    {"zfs", 0x2fc12fc1},
+    {NULL, 0}
+};
+#endif /* !MACOS */
+
+/* content of a file searched with -i, result lines point in it */
+struct fbuf_s {
+    int state;      /* 0: not read, 1: read, -1: open error */
+    int fd;
+    int mapped;     /* data is a mmap() of the file, else malloc() */
+    char *data;
+    size_t len;
+};
+
+struct finfo_s {
+    char *fi_path;          /* for results and error messages */
+    const char *fi_name;    /* last component of fi_path */
+    size_t fi_root;         /* length of the scanned path in fi_path */
+    int fi_dfd;             /* directory of fi_name, or AT_FDCWD */
+    enum file_type_e fi_type;
+    struct stat fi_stat;
+};
+
+/* versions of filter_object(), x->filter_mode */
+enum filter_mode_e {
+    FILTER_GENERIC,
+    FILTER_LS,
+    FILTER_EXT,
+    FILTER_WIN,
+    FILTER_WIN_ICASE,
+    FILTER_WNF,
+    FILTER_WNF_ICASE,
+    FILTER_WIF,
+    FILTER_QUERIES
+};
+
+/* tests compiled in filter_object_mask() */
+enum filter_mask_e {
+    F_GENERIC = 0x01,
+    F_LS = 0x02,
+    F_EXT = 0x04,
+    F_WIN = 0x08,
+    F_WNF = 0x10,
+    F_WIF = 0x20,
+    F_ICASE = 0x40
+};
+
+/* path for the syscalls: name in its directory, or full path */
+#define FI_AT(fi) ((fi)->fi_dfd == AT_FDCWD ? (fi)->fi_path : (fi)->fi_name)
+
+/* context of the scan, for the reads of a query (--queries) */
+#define WALK_CTX(x) ((x)->walk ? (x)->walk : (x))
+
+static char *set_object_path(struct sfile_ctx_s *x, const char *path);
+static char *get_current_dir(struct sfile_ctx_s *x);
+static void set_object_name(struct finfo_s *fi);
+static enum file_type_e get_file_type(struct sfile_ctx_s *x,
+                                      struct finfo_s *fi);
+static enum file_type_e stat_file_type(struct finfo_s *fi);
+static int object_is_archive(const char *name);
+static void list_dir_object(struct sfile_ctx_s *x, const char *path);
+static void walk_init(struct sfile_ctx_s *x, struct walk_s *w);
+static void walk_free(struct walk_s *w);
+static void walk_dlist(struct sfile_ctx_s *x, struct walk_s *w,
+                       const char *path, struct ancestor_s *anc);
+static void scan_dir(struct sfile_ctx_s *x, struct walk_s *w,
+                     const char *path);
+static DIR *open_dir(struct sfile_ctx_s *x, const char *path);
+static int open_long_path(const char *path, int flags);
+static void walk_path_reserve(struct walk_s *w, size_t len);
+static void walk_set_dir(struct walk_s *w, const char *path);
+static void sched_scan(struct sfile_ctx_s *x, char **paths, int n_paths);
+static void sched_push(struct sched_s *s, const char *path, dev_t dev,
+                       dev_t root_dev, size_t root_len,
+                       struct ancestor_s *anc);
+static void sched_scan_here(struct sched_s *s, struct sched_dir_s *d);
+static void *sched_worker(void *data);
+static int dev_jobs(struct sfile_ctx_s *x, const char *path, dev_t dev);
+static int keep_dir_entry(struct sfile_ctx_s *x, const char *name);
+static void list_dir_entry(struct sfile_ctx_s *x, struct walk_s *w,
+                           int dfd, const char *name,
+                           const struct stat *st);
+static void list_dir_batch(struct sfile_ctx_s *x, struct walk_s *w,
+                           DIR *dir);
+static int cmp_batch_inode(const void *a, const void *b);
+static int cmp_batch_first(const void *a, const void *b);
+static int name_match(struct sfile_ctx_s *x, const char *name);
+static int win_match(const struct sfile_ctx_s *x, const char *name);
+static int wnf_match(const struct sfile_ctx_s *x, const char *name);
+static void prefetch_file(int dfd, const struct batch_entry_s *be,
+                          const char *names);
+static int check_object(struct sfile_ctx_s *x, struct finfo_s *finfo);
+static int filter_object(struct sfile_ctx_s *x, struct finfo_s *fi);
+static int filter_object_mode(struct sfile_ctx_s *x, struct finfo_s *fi,
+                              struct fbuf_s *fb);
+static int cold_defer(struct sfile_ctx_s *x, const struct finfo_s *fi,
+                      int *fd);
+static int file_cached(struct sfile_ctx_s *x, const struct finfo_s *fi,
+                       int *fd);
+static int cache_probe(int fd, size_t len);
+static int cold_start(struct sfile_ctx_s *x);
+static void *cold_reader(void *data);
+static void cold_drain(struct sfile_ctx_s *x);
+static void cold_free(struct sfile_ctx_s *x);
+static inline int filter_object_mask(struct sfile_ctx_s *x,
+                                     struct finfo_s *fi, unsigned mask,
+                                     struct fbuf_s *shared)
+    __attribute__((always_inline));
+static int filter_queries(struct sfile_ctx_s *x, struct finfo_s *fi,
+                          struct fbuf_s *shared);
+static int reads_files(const struct sfile_ctx_s *x);
+static int report_object(struct sfile_ctx_s *x, struct finfo_s *fi,
+                         struct sfile_result_s *res, struct stack_s *lines);
+static int which_is_exact(struct sfile_ctx_s *x);
+static int descend_dir(struct sfile_ctx_s *x, struct walk_s *w,
+                       struct finfo_s *fi);
+static int fstype_is_skipped(struct sfile_ctx_s *x, const char *path,
+                             dev_t dev);
+static int fstype_match(struct sfile_ctx_s *x, const char *path);
+static struct ancestor_s *ancestor_new(struct sfile_ctx_s *x,
+                                       struct ancestor_s *parent,
+                                       pthread_mutex_t *lock,
+                                       const struct stat *st);
+static void ancestor_release(struct ancestor_s *anc, pthread_mutex_t *lock);
+static int shard_keep(struct sfile_ctx_s *x, struct walk_s *w,
+                      const char *path, int *descend);
+static int shard_of(struct sfile_ctx_s *x, const char *path);
+static int which_probe_dir(struct sfile_ctx_s *x, const char *dir);
+static int ign_file_extension(const char *name, char **ext);
+static int cmp_file_extension(const char *name, const char *ext);
+static void push_dir_stack(struct stack_s *stack, const char *path,
+                           struct ancestor_s *anc, int fifo);
+static int word_in_file(struct sfile_ctx_s *x, const struct finfo_s *fi,
+                        struct sfile_result_s *res, struct stack_s *lines,
+                        struct fbuf_s *fb);
+static const char *search_file(struct sfile_ctx_s *x, const struct fbuf_s *fb,
+                               size_t *scan, size_t len, size_t *match_len);
+static size_t push_context_line(struct stack_s *lines,
+                                const struct fbuf_s *fb, size_t pos, long n);
+static size_t next_line(const struct fbuf_s *fb, size_t pos);
+static size_t line_len(const struct fbuf_s *fb, size_t pos, size_t next);
+static long count_lines(const char *buf, size_t len);
+static char *mem_search(const char *mem, size_t mem_len, const char *str,
+                        size_t len);
+static void free_line_stack(struct stack_chunk_s *chunk);
+static void push_line_stack(struct stack_s *stack, const char *line,
+                            size_t len, long n, long off, size_t col,
+                            size_t match_len, int context);
+static int fbuf_open(struct sfile_ctx_s *x, const struct finfo_s *fi,
+                     struct fbuf_s *fb);
+static void fbuf_init(struct fbuf_s *fb, int fd);
+static void fbuf_close(struct sfile_ctx_s *x, struct fbuf_s *fb);
+static int file_is_settled(const struct stat *st);
+static int open_object(const struct finfo_s *fi, int flags);
+static int open_read_file(struct sfile_ctx_s *x, const struct finfo_s *fi,
+                          int report);
+static void close_read_file(struct sfile_ctx_s *x, int fd);
+static int filter_mode(struct sfile_ctx_s *x);
+static struct sfile_fold_s *fold_new(const char *str);
+static void fold_init(struct sfile_fold_s *f, const char *str, size_t len);
+static void fold_free(struct sfile_fold_s *f);
+static void fold_set_lead(struct sfile_fold_s *f, uint32_t cp);
+static uint32_t fold_cp(uint32_t cp);
+static const char *utf8_decode(const char *p, const char *end, uint32_t *cp);
+static const char *fold_match(const struct sfile_fold_s *f, const char *p,
+                              const char *end);
+static const char *fold_next(const struct sfile_fold_s *f, const char *p,
+                             const char *end);
+static const char *fold_find(const struct sfile_fold_s *f, const char *mem,
+                             size_t len, size_t *match_len);
+static int fold_equal(const struct sfile_fold_s *f, const char *name);
+static void fuzzy_init(struct sfile_ctx_s *x);
+static void fuzzy_free(struct sfile_ctx_s *x);
+static int fuzzy_add(struct sfile_ctx_s *x, const struct finfo_s *fi);
+static int fuzzy_distance(const struct sfile_fuzzy_s *f, const char *name,
+                          int max);
+static int fuzzy_cmp(const struct fuzzy_entry_s *a,
+                     const struct fuzzy_entry_s *b);
+static int fuzzy_cmp_qsort(const void *a, const void *b);
+static void fuzzy_sift_down(struct sfile_fuzzy_s *f, size_t i);
+static void summary_add(struct sfile_ctx_s *x, const struct finfo_s *fi,
+                        unsigned long n_match);
+static struct sfile_summary_s *summary_row(struct summary_table_s *t,
+                                           const char *dir, size_t len);
+static struct sfile_summary_s *summary_slot(struct summary_table_s *t,
+                                            const char *dir, size_t len);
+static void summary_merge(struct summary_table_s *to,
+                          struct summary_table_s *from);
+static void summary_thread_exit(void);
+static void summary_free(struct sfile_ctx_s *x);
+static int cmp_summary(const void *a, const void *b);
+static void sample_dir_object(struct sfile_ctx_s *x, const char *path);
+static int sample_probe(struct sfile_ctx_s *x, const char *path);
+static int sample_dir(struct sfile_ctx_s *x, struct walk_s *w,
+                      const char *path, double *weight, char **next);
+static int sample_is_dir(struct sfile_ctx_s *x, struct walk_s *w, int dfd,
+                         const struct dirent *ent);
+static void sample_check(struct sfile_ctx_s *x, struct finfo_s *fi);
+static void sample_add(struct sfile_ctx_s *x, unsigned long n_match);
+static uint64_t sample_rand(struct sfile_sample_s *s);
+static void sample_result(struct sfile_ctx_s *x, struct sfile_estimate_s *est);
+static void sample_free(struct sfile_ctx_s *x);
+static void throttle_init(struct sfile_ctx_s *x);
+static void throttle_io(struct sfile_ctx_s *x, double ops, double bytes);
+static double bucket_take(struct sfile_bucket_s *b, double now, double n);
+static double clock_seconds(clockid_t clk);
+static double trace_begin(struct sfile_ctx_s *x);
+static void trace_end(struct sfile_ctx_s *x, const char *name,
+                      const char *arg, double start);
+static struct trace_thread_s *trace_thread(struct sfile_ctx_s *x);
+static void trace_thread_exit(struct sfile_ctx_s *x);
+static void trace_submit(struct trace_thread_s *th);
+static void *trace_flusher(void *data);
+static void trace_write(struct sfile_trace_s *t, const char *data,
+                        size_t len);
+static void trace_put(struct trace_thread_s *th, const char *str,
+                      size_t len);
+static void trace_put_json(struct trace_thread_s *th, const char *str);
+static void *scan_stream_worker(void *data);
+static void queue_init(struct queue_s *q, size_t size);
+static void queue_free(struct queue_s *q);
+static void queue_push(struct queue_s *q, void *item);
+static void *queue_pop(struct queue_s *q);
+static void queue_close(struct queue_s *q);
+static void *xmalloc(size_t size);
+static char *xstrdup(const char *str);
+static void xfree(void *ptr);
+static void out_memory(const char *func_name) __attribute__((noreturn));
+
+/*  list archive extension */
+static const char *tab_archive[] =
+     {".gz", ".bz2", ".zip", ".rar", ".7z", NULL};
+
+void
+sfile_init(struct sfile_ctx_s *x)
+{
+    memset(x, 0, sizeof(struct sfile_ctx_s));
+    x->byino = -1;
+    x->byuid = -1;
+    x->n_exit = -1;
+    x->n_jobs = 1;
+    x->fuzzy_dist = 2;
+    x->fuzzy_top_n = 20;
+    x->summary_depth = -1;
+    x->prog_name = "sfile";
+    pthread_mutex_init(&x->lock, NULL);
+    pthread_mutex_init(&x->dev_lock, NULL);
+    pthread_mutex_init(&x->throttle.lock, NULL);
+    atomic_init(&x->stop, 0);
+}
+
+void
+sfile_free(struct sfile_ctx_s *x)
+{
+    sfile_trace_close(x);
+    fuzzy_free(x);
+    xfree(x->fuzzy);
+    fold_free(x->fold_win);
+    fold_free(x->fold_wnf);
+    fold_free(x->fold_wif);
+    cold_free(x);
+    summary_free(x);
+    sample_free(x);
+    xfree(x->ign);
+    xfree(x->ext);
+    xfree(x->wif);
+    xfree(x->win);
+    xfree(x->wnf);
+    sfile_free_str_array(x->ign_ext);
+    sfile_free_str_array(x->skip_fstype);
+    xfree(x->dev_cache);
+    xfree(x->queries);
+    pthread_mutex_destroy(&x->lock);
+    pthread_mutex_destroy(&x->dev_lock);
+    pthread_mutex_destroy(&x->throttle.lock);
+}
+
+void
+sfile_set_callback(struct sfile_ctx_s *x, sfile_result_cb cb, void *data)
+{
+    x->result_cb = cb;
+    x->result_data = data;
+}
+
+/* callback of the rows of x->summary_depth, called by sfile_finish() */
+void
+sfile_set_summary_callback(struct sfile_ctx_s *x, sfile_summary_cb cb,
+                           void *data)
+{
+    x->summary_cb = cb;
+    x->summary_data = data;
+}
+
+/* callback of the totals of --estimate, called by sfile_finish() */
+void
+sfile_set_estimate_callback(struct sfile_ctx_s *x, sfile_estimate_cb cb,
+                            void *data)
+{
+    x->estimate_cb = cb;
+    x->estimate_data = data;
+}
+
+/*
+ * Check the entries of the scans of x with q too (--queries), q is
+ * prepared and has its own callback. x reads each file once for all
+ * its queries, its own search options are not used. Add the queries
+ * before sfile_prepare(x), q is freed by the caller after x.
+ */
+void
+sfile_add_query(struct sfile_ctx_s *x, struct sfile_ctx_s *q)
+{
+    x->queries = realloc(x->queries, (x->n_queries + 1) *
+                         sizeof(struct sfile_ctx_s *));
+    if (!x->queries)
+        out_memory("realloc");
+    x->queries[x->n_queries++] = q;
+    q->walk = x;
+}
+
+void
+sfile_prepare(struct sfile_ctx_s *x)
+{
+    struct rlimit rl;
+
+    if (!x->wif && !x->win && !x->wnf && !x->ext &&
+        x->byuid == -1 && x->byino == -1) {
+        x->opts |= O_LS_MODE;
+    }
+
+    /*
+     * Set pointer on string search/cmp functions, the case insensitive
+     * searches use the needles folded once.
+     */
+    x->cmpstring_wnf = strcmp;
+    x->searchstring_win = strstr;
+    x->searchmem_wif = mem_search;
+    fold_free(x->fold_win);
+    fold_free(x->fold_wnf);
+    fold_free(x->fold_wif);
+    x->fold_win = NULL;
+    x->fold_wnf = NULL;
+    x->fold_wif = NULL;
+    if ((x->opts & O_IGN_CASE_FILE_NAME) && x->win)
+        x->fold_win = fold_new(x->win);
+    if ((x->opts & O_IGN_CASE_FILE_NAME) && x->wnf)
+        x->fold_wnf = fold_new(x->wnf);
+    if ((x->opts & O_IGN_CASE_IN_FILE) && x->wif)
+        x->fold_wif = fold_new(x->wif);
+#ifndef MACOS
+    if (x->skip_fstype) {
+        char **p_name = NULL;
+        const struct fstype_s *p_fs = NULL;
+
+        for (p_name = x->skip_fstype; *p_name; p_name++) {
+            for (p_fs = tab_fstype; p_fs->name; p_fs++) {
+                if (!strcmp(p_fs->name, *p_name))
+                    break;
+            }
+            if (!p_fs->name)
+                fprintf(stderr, "%s: unknown file system type `%s'\n",
+                        x->prog_name, *p_name);
+        }
+    }
+#endif /* !MACOS */
+    sample_free(x);
+    if (x->estimate_fraction > 0 || x->estimate_time > 0) {
+        x->sample = xmalloc(sizeof(struct sfile_sample_s));
+        memset(x->sample, 0, sizeof(struct sfile_sample_s));
+        x->sample->acc = x->sample->total;
+        x->sample->weight = 1;
+        x->sample->start = clock_seconds(CLOCK_MONOTONIC);
+        x->sample->rand = ((uint64_t) (clock_seconds(CLOCK_REALTIME) * 1e6) ^
+                           ((uint64_t) getpid() << 40)) | 1;
+    }
+    x->filter_mode = x->n_queries ? FILTER_QUERIES : filter_mode(x);
+    if (x->fuzzy)
+        fuzzy_init(x);
+    cold_free(x);
+    if ((x->opts & O_CACHE_FIRST) && !x->sample) {
+        x->cold = xmalloc(sizeof(struct sfile_cold_s));
+        memset(x->cold, 0, sizeof(struct sfile_cold_s));
+        pthread_mutex_init(&x->cold->lock, NULL);
+        pthread_cond_init(&x->cold->cond, NULL);
+        x->cold->x = x;
+        /* a queued file keeps its fd */
+        x->cold->max = SFILE_COLD_QUEUE;
+        if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur != RLIM_INFINITY &&
+            rl.rlim_cur / 4 < x->cold->max)
+            x->cold->max = (size_t) (rl.rlim_cur / 4);
+    }
+    summary_free(x);
+    if (x->summary_depth >= 0) {
+        x->summary = xmalloc(sizeof(struct sfile_sums_s));
+        memset(x->summary, 0, sizeof(struct sfile_sums_s));
+        pthread_mutex_init(&x->summary->lock, NULL);
+    }
+    throttle_init(x);
+    atomic_store(&x->stop, !x->n_exit);
+}
+
+/*
+ * Scan one object: list it if is a directory, else check it.
+ * An empty path is the current directory.
+ */
+int
+sfile_scan_path(struct sfile_ctx_s *x, const char *path)
+{
+    struct finfo_s finfo;
+
+    if (SFILE_STOPPED(x))
+        return 0;
+    finfo.fi_path = set_object_path(x, path);
+    set_object_name(&finfo);
+    finfo.fi_type = get_file_type(x, &finfo);
+    if (finfo.fi_type == TF_ERROR) {
+        xfree(finfo.fi_path);
+        return -1;
+    }
+    if (finfo.fi_type == TF_DIR)
+        list_dir_object(x, finfo.fi_path);
+    else if (x->sample)
+        sample_check(x, &finfo);
+    else if (!x->shard_n || shard_of(x, path) == x->shard_i)
+        check_object(x, &finfo);
+    xfree(finfo.fi_path);
+    return 0;
+}
+
+/*
+ * Scan several paths, with the per device scheduler if x->n_jobs > 1.
+ */
+int
+sfile_scan_paths(struct sfile_ctx_s *x, char **paths, int n_paths)
+{
+    int i;
+
+    if (x->n_jobs > 1 && !x->sample) {
+        sched_scan(x, paths, n_paths);
+        return 0;
+    }
+    for (i = 0; i < n_paths && !SFILE_STOPPED(x); i++)
+        sfile_scan_path(x, paths[i]);
+    return 0;
+}
+
+/*
+ * Scan directories in $PATH.
+ * With an exact name (-N) and no other search, each directory is
+ * probed with fstatat(), without list it, and the search stop at
+ * the first result unless O_ALL (-a) is set.
+ */
+void
+sfile_scan_path_environ(struct sfile_ctx_s *x)
+{
+    int exact;
+    char *envpath = NULL;
+    char *buf = NULL;
+    char *save = NULL;
+
+    buf = getenv(ENV_VAR_PATH);
+    if (!buf || !buf[0]) {
+#ifndef NDEBUG
+        fprintf(stderr, "Environement variable `%s' not set or is empty.",
+                ENV_VAR_PATH);
+#endif /* NDEBUG */
+        return;
+    }
+    /* do not change the environment with strtok_r() */
+    envpath = xstrdup(buf);
+
+    exact = which_is_exact(x);
+    buf = strtok_r(envpath, ":", &save);
+    while (buf && !SFILE_STOPPED(x)) {
+        if (!exact)
+            list_dir_object(x, buf);
+        else if (which_probe_dir(x, buf) && !(x->opts & O_ALL))
+            break;
+        buf = strtok_r(NULL, ":", &save);
+    }
+    xfree(envpath);
+}
+
+/* file name is the only search, and can be found without list */
+static int
+which_is_exact(struct sfile_ctx_s *x)
+{
+    return (x->wnf && !x->win && !x->wif && !x->ext &&
+            x->byuid == -1 && x->byino == -1 &&
+            !(x->opts & O_IGN_CASE_FILE_NAME) &&
+            !strchr(x->wnf, '/') &&
+            (!x->ign || !strstr(x->wnf, x->ign)));
+}
+
+/* return 1 if x->wnf is in dir and is a result */
+static int
+which_probe_dir(struct sfile_ctx_s *x, const char *dir)
+{
+    int ret;
+    size_t len;
+    struct finfo_s fi;
+
+    len = strlen(dir);
+    fi.fi_path = xmalloc(len + strlen(x->wnf) + 2);
+    memcpy(fi.fi_path, dir, len);
+    if (!len || dir[len - 1] != '/')
+        fi.fi_path[len++] = '/';
+    strcpy(fi.fi_path + len, x->wnf);
+    fi.fi_name = fi.fi_path + len;
+    fi.fi_root = len;
+    fi.fi_dfd = AT_FDCWD;
+    throttle_io(x, 1, 0);
+    ret = 0;
+    if (!fstatat(AT_FDCWD, fi.fi_path, &fi.fi_stat,
+                 (x->opts & O_FOLLOW_LINK) ? 0 : AT_SYMLINK_NOFOLLOW)) {
+        fi.fi_type = stat_file_type(&fi);
+        ret = filter_object(x, &fi);
+    }
+    xfree(fi.fi_path);
+    return ret;
+}
+
+/*
+ * Scan all paths read in stream, separated by delim ('\n' or '\0').
+ * With x->n_jobs > 1, paths are given to a pool of workers by a
+ * bounded queue, so the list is never fully in memory.
+ */
+int
+sfile_scan_stream(struct sfile_ctx_s *x, FILE *stream, int delim)
+{
+    int i;
+    int ret;
+    int n_workers;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    pthread_t *workers = NULL;
+    struct queue_s q;
+
+    n_workers = 0;
+    if (x->n_jobs > 1 && !x->sample) {
+        queue_init(&q, (size_t) x->n_jobs * SFILE_QUEUE_PER_JOB);
+        q.x = x;
+        workers = xmalloc((size_t) x->n_jobs * sizeof(pthread_t));
+        for (i = 0; i < x->n_jobs; i++) {
+            ret = pthread_create(&workers[n_workers], NULL,
+                                 scan_stream_worker, &q);
+            if (ret) {
+                fprintf(stderr, "%s:pthread_create: %s\n", x->prog_name,
+                        strerror(ret));
+                break;
+            }
+            n_workers++;
+        }
+    }
+
+    while (!SFILE_STOPPED(x) &&
+           (len = getdelim(&line, &size, delim, stream)) != -1) {
+        if (len && line[len - 1] == delim)
+            line[--len] = '\0';
+        if (!len)
+            continue;
+        if (n_workers)
+            queue_push(&q, xstrdup(line));
+        else
+            sfile_scan_path(x, line);
+    }
+    xfree(line);
+    if (ferror(stream)) {
+        fprintf(stderr, "%s:getdelim: %s\n", x->prog_name, strerror(errno));
+    }
+
+    if (workers) {
+        queue_close(&q);
+        for (i = 0; i < n_workers; i++)
+            pthread_join(workers[i], NULL);
+        queue_free(&q);
+        xfree(workers);
+    }
+    return 0;
+}
+
+static void *
+scan_stream_worker(void *data)
+{
+    char *path = NULL;
+    struct queue_s *q = data;
+
+    while ((path = queue_pop(q))) {
+        sfile_scan_path(q->x, path);
+        xfree(path);
+    }
+    trace_thread_exit(q->x);
+    summary_thread_exit();
+    return NULL;
+}
+
+/* path of a scanned object, to free */
+static char *
+set_object_path(struct sfile_ctx_s *x, const char *path)
+{
+    char *cwd = NULL;
+    char *name = NULL;
+
+    /* if path begin by '/', it is already full path */
+    if (path[0] == '/')
+        return xstrdup(path);
+    /* set full path */
+    if ((x->opts & O_FULL_PATH)) {
+        cwd = get_current_dir(x);
+        if (!cwd)
+            return xstrdup(path);
+        name = xmalloc(strlen(cwd) + strlen(path) + 1);
+        strcpy(name, cwd);
+        strcat(name, path);
+        xfree(cwd);
+        return name;
+    }
+    /* need add ./ */
+    if (!path[0] || (path[0] != '.' && path[1] != '/')) {
+        name = xmalloc(strlen(path) + 3);
+        name[0] = '.';
+        name[1] = '/';
+        strcpy(name + 2, path);
+        return name;
+    }
+    return xstrdup(path);
+}
+
+/* current directory ending by '/', to free */
+static char *
+get_current_dir(struct sfile_ctx_s *x)
+{
+    size_t len;
+    size_t size;
+    char *current_path = NULL;
+
+    for (size = 256;; size *= 2) {
+        current_path = xmalloc(size);
+        if (getcwd(current_path, size - 1))
+            break;
+        xfree(current_path);
+        if (errno != ERANGE) {
+            fprintf(stderr, "%s:getcwd: get current path fails\n",
+                    x->prog_name);
+            return NULL;
+        }
+    }
+    len = strlen(current_path);
+    if (!len || current_path[len - 1] != '/') {
+        current_path[len++] = '/';
+        current_path[len] = '\0';
+    }
+    return current_path;
+}
+
+/* fi_name of an object given by path */
+static void
+set_object_name(struct finfo_s *fi)
+{
+    fi->fi_dfd = AT_FDCWD;
+    fi->fi_name = strrchr(fi->fi_path, '/');
+    fi->fi_name = fi->fi_name ? fi->fi_name + 1 : fi->fi_path;
+    fi->fi_root = (size_t) (fi->fi_name - fi->fi_path);
+}
+
+static enum file_type_e
+get_file_type(struct sfile_ctx_s *x, struct finfo_s *fi)
+{
+    int ret;
+    double t;
+
+    throttle_io(x, 1, 0);
+    TRACE_BEGIN(x, stat, fi->fi_path, t);
+    ret = -1;
+    /* broken link with --follow: use the link */
+    if ((x->opts & O_FOLLOW_LINK))
+        ret = fstatat(fi->fi_dfd, FI_AT(fi), &fi->fi_stat, 0);
+    if (ret == -1)
+        ret = fstatat(fi->fi_dfd, FI_AT(fi), &fi->fi_stat,
+                      AT_SYMLINK_NOFOLLOW);
+    TRACE_END(x, stat, fi->fi_path, t);
+    if (ret == -1) {
+        fprintf(stderr, "%s:lstat:path `%s': %s\n", x->prog_name,
+                fi->fi_path, strerror(errno));
+        return TF_ERROR;
+    }
+    return stat_file_type(fi);
+}
+
+/* type of object with fi_stat already set */
+static enum file_type_e
+stat_file_type(struct finfo_s *fi)
+{
+    size_t len;
+
+    if (S_ISDIR(fi->fi_stat.st_mode))
+        return TF_DIR;
+    len = strlen(fi->fi_name);
+    if (len && fi->fi_name[len - 1] == '~')
+        return TF_BACKUP;
+    else if (!object_is_archive(fi->fi_name))
+        return TF_ARCHIVE;
+    else if (S_ISREG(fi->fi_stat.st_mode))
+        return TF_REG;
+    return TF_OTHER;
+}
+
+static int
+object_is_archive(const char *name)
+{
+    const char **p_tab_archive = NULL;
+    char *ext = NULL;
+
+    ext = strrchr(name, '.');
+    if (ext) {
+        p_tab_archive = tab_archive;
+        do {
+            if (!strcmp(*p_tab_archive, ext))
+                return 0;
+        } while (*++p_tab_archive);
+    }
+    return -1;
+}
+
+static void
+list_dir_object(struct sfile_ctx_s *x, const char *path)
+{
+    struct stat st;
+    struct walk_s w;
+    struct ancestor_s *anc = NULL;
+
+    if (x->sample) {
+        sample_dir_object(x, path);
+        return;
+    }
+    walk_init(x, &w);
+    w.root_len = strlen(path);
+    if (!stat(path, &st)) {
+        w.root_dev = st.st_dev;
+        anc = ancestor_new(x, NULL, NULL, &st);
+    }
+    walk_dlist(x, &w, path, anc);
+    walk_free(&w);
+}
+
+/*
+ * Scan path, and its subdirectories by the directory list of w. anc
+ * is the node of path for --follow, released here.
+ */
+static void
+walk_dlist(struct sfile_ctx_s *x, struct walk_s *w, const char *path,
+           struct ancestor_s *anc)
+{
+    struct walk_dir_s *d = NULL;
+    struct stack_chunk_s *p_next = NULL;
+
+    push_dir_stack(&w->dlist, path, anc, (x->opts & O_FIRST_FAST));
+    do {
+        d = w->dlist.chunk->un.data;
+        w->anc = d->anc;
+        scan_dir(x, w, d->path);
+        w->anc = NULL;
+        p_next = w->dlist.chunk->next;
+        ancestor_release(d->anc, w->anc_lock);
+        xfree(d->path);
+        xfree(d);
+        xfree(w->dlist.chunk);
+        w->dlist.chunk = p_next;
+    } while (!SFILE_STOPPED(x) && w->dlist.chunk);
+
+    /* n_exit reached: free directories not scanned */
+    while (w->dlist.chunk) {
+        p_next = w->dlist.chunk->next;
+        d = w->dlist.chunk->un.data;
+        ancestor_release(d->anc, w->anc_lock);
+        xfree(d->path);
+        xfree(d);
+        xfree(w->dlist.chunk);
+        w->dlist.chunk = p_next;
+    }
+}
+
+static void
+walk_init(struct sfile_ctx_s *x, struct walk_s *w)
+{
+    (void) x;
+    memset(w, 0, sizeof(struct walk_s));
+}
+
+static void
+walk_free(struct walk_s *w)
+{
+    xfree(w->path);
+    xfree(w->batch.ent);
+    xfree(w->batch.names);
+}
+
+/* check all entries of one directory */
+static void
+scan_dir(struct sfile_ctx_s *x, struct walk_s *w, const char *path)
+{
+    int dfd;
+    double t;
+    DIR *dir = NULL;
+    struct dirent *ent = NULL;
+
+    throttle_io(x, 1, 0);
+    dir = open_dir(x, path);
+    if (!dir)
+        return;
+    TRACE_BEGIN(x, scan_dir, path, t);
+    walk_set_dir(w, path);
+    dfd = dirfd(dir);
+    if ((x->opts & (O_INODE_ORDER | O_FIRST_FAST)))
+        list_dir_batch(x, w, dir);
+    else {
+        do {
+            ent = readdir(dir);
+            if (!ent)
+                break;
+            if (keep_dir_entry(x, ent->d_name))
+                list_dir_entry(x, w, dfd, ent->d_name, NULL);
+        } while (!SFILE_STOPPED(x));
+    }
+    closedir(dir);
+    TRACE_END(x, scan_dir, path, t);
+}
+
+static DIR *
+open_dir(struct sfile_ctx_s *x, const char *path)
+{
+    int fd;
+    double t;
+    DIR *dir = NULL;
+
+    TRACE_BEGIN(x, opendir, path, t);
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_NOCTTY | O_CLOEXEC);
+    if (fd == -1 && errno == ENAMETOOLONG)
+        fd = open_long_path(path, O_RDONLY | O_DIRECTORY | O_NOCTTY |
+                            O_CLOEXEC);
+    if (fd != -1) {
+        dir = fdopendir(fd);
+        if (!dir)
+            close(fd);
+    }
+    TRACE_END(x, opendir, path, t);
+    if (!dir)
+        fprintf(stderr, "%s:opendir: path: `%s': %s\n", x->prog_name,
+                path, strerror(errno));
+    return dir;
+}
+
+/* open a path longer than PATH_MAX, one component at a time */
+static int
+open_long_path(const char *path, int flags)
+{
+    int fd;
+    int dfd;
+    char *copy = NULL;
+    char *name = NULL;
+    char *next = NULL;
+
+    copy = xstrdup(path);
+    dfd = AT_FDCWD;
+    name = copy;
+    if (*name == '/') {
+        dfd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        name++;
+    }
+    fd = dfd;
+    while (fd != -1 && *name) {
+        next = strchr(name, '/');
+        if (next)
+            *next++ = '\0';
+        else
+            next = name + strlen(name);
+        if (*name) {
+            fd = openat(dfd, name, (*next) ?
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC : flags);
+            if (dfd != AT_FDCWD)
+                close(dfd);
+            dfd = fd;
+        }
+        name = next;
+    }
+    xfree(copy);
+    return fd;
+}
+
+/* room for len characters and '\0' in w->path */
+static void
+walk_path_reserve(struct walk_s *w, size_t len)
+{
+    if (len < w->path_size)
+        return;
+    while (len >= w->path_size)
+        w->path_size = w->path_size ? w->path_size * 2 : 4096;
+    w->path = realloc(w->path, w->path_size);
+    if (!w->path)
+        out_memory("realloc");
+}
+
+/* names of the entries are appended to the directory path */
+static void
+walk_set_dir(struct walk_s *w, const char *path)
+{
+    size_t len;
+
+    len = strlen(path);
+    walk_path_reserve(w, len + 1);
+    memcpy(w->path, path, len);
+    if (!len || path[len - 1] != '/')
+        w->path[len++] = '/';
+    w->path[len] = '\0';
+    w->path_len = len;
+}
+
+/*
+ * Scan the paths with the per device scheduler (x->n_jobs > 1):
+ * directories are grouped by st_dev, each device has its own queue
+ * and dev_jobs() threads. Results of all threads go to the same
+ * callback. Other objects are checked here.
+ */
+static void
+sched_scan(struct sfile_ctx_s *x, char **paths, int n_paths)
+{
+    int i;
+    size_t j;
+    struct sched_s s;
+    struct finfo_s fi;
+
+    memset(&s, 0, sizeof(struct sched_s));
+    s.x = x;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.done, NULL);
+
+    for (i = 0; i < n_paths && !SFILE_STOPPED(x); i++) {
+        fi.fi_path = set_object_path(x, paths[i]);
+        set_object_name(&fi);
+        fi.fi_type = get_file_type(x, &fi);
+        if (fi.fi_type == TF_ERROR) {
+            xfree(fi.fi_path);
+            continue;
+        }
+        if (fi.fi_type == TF_DIR) {
+            sched_push(&s, fi.fi_path, fi.fi_stat.st_dev, fi.fi_stat.st_dev,
+                       strlen(fi.fi_path),
+                       ancestor_new(x, NULL, NULL, &fi.fi_stat));
+        }
+        else if (!x->shard_n || shard_of(x, paths[i]) == x->shard_i)
+            check_object(x, &fi);
+        xfree(fi.fi_path);
+    }
+
+    /* no more roots, wait the end of the scan, then the threads */
+    pthread_mutex_lock(&s.lock);
+    s.closed = 1;
+    for (j = 0; j < s.n_devs; j++)
+        pthread_cond_broadcast(&s.devs[j]->cond);
+    while (s.pending)
+        pthread_cond_wait(&s.done, &s.lock);
+    pthread_mutex_unlock(&s.lock);
+    for (j = 0; j < s.n_threads; j++)
+        pthread_join(s.threads[j], NULL);
+
+    for (j = 0; j < s.n_devs; j++) {
+        pthread_cond_destroy(&s.devs[j]->cond);
+        xfree(s.devs[j]);
+    }
+    xfree(s.devs);
+    xfree(s.threads);
+    pthread_cond_destroy(&s.done);
+    pthread_mutex_destroy(&s.lock);
+}
+
+/* add a directory in the queue of its device, start device threads */
+static void
+sched_push(struct sched_s *s, const char *path, dev_t dev, dev_t root_dev,
+           size_t root_len, struct ancestor_s *anc)
+{
+    int i;
+    int ret;
+    int n_jobs;
+    size_t j;
+    struct sched_dir_s *d = NULL;
+    struct sched_dev_s *sd = NULL;
+
+    d = xmalloc(sizeof(struct sched_dir_s));
+    d->path = xstrdup(path);
+    d->root_dev = root_dev;
+    d->root_len = root_len;
+    d->anc = anc;
+
+    n_jobs = 0;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        for (j = 0; j < s->n_devs; j++) {
+            if (s->devs[j]->dev == dev) {
+                sd = s->devs[j];
+                break;
+            }
+        }
+        if (sd || n_jobs)
+            break;
+        /* new device: sysfs and statfs() without lock */
+        pthread_mutex_unlock(&s->lock);
+        n_jobs = dev_jobs(s->x, path, dev);
+        pthread_mutex_lock(&s->lock);
+    }
+
+    if (!sd) {
+        sd = xmalloc(sizeof(struct sched_dev_s));
+        sd->dev = dev;
+        sd->n_jobs = n_jobs;
+        sd->head = NULL;
+        sd->tail = NULL;
+        sd->s = s;
+        pthread_cond_init(&sd->cond, NULL);
+        s->devs = realloc(s->devs, (s->n_devs + 1) *
+                          sizeof(struct sched_dev_s *));
+        s->threads = realloc(s->threads, (s->n_threads + (size_t) n_jobs) *
+                             sizeof(pthread_t));
+        if (!s->devs || !s->threads)
+            out_memory("realloc");
+        s->devs[s->n_devs++] = sd;
+        for (i = 0; i < n_jobs; i++) {
+            ret = pthread_create(&s->threads[s->n_threads], NULL,
+                                 sched_worker, sd);
+            if (ret) {
+                fprintf(stderr, "%s:pthread_create: %s\n", s->x->prog_name,
+                        strerror(ret));
+                break;
+            }
+            s->n_threads++;
+        }
+        sd->n_jobs = i;
+    }
+    /* no thread for this device: scan here, without the scheduler */
+    if (!sd->n_jobs) {
+        pthread_mutex_unlock(&s->lock);
+        sched_scan_here(s, d);
+        return;
+    }
+
+    /* --first-fast: first in, first out, shallow directories first */
+    if ((s->x->opts & O_FIRST_FAST)) {
+        d->next = NULL;
+        if (sd->head)
+            sd->tail->next = d;
+        else
+            sd->head = d;
+        sd->tail = d;
+    }
+    /* last in, first out: keep the queue small */
+    else {
+        d->next = sd->head;
+        sd->head = d;
+    }
+    s->pending++;
+    pthread_cond_signal(&sd->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* scan d and its subtree in the calling thread */
+static void
+sched_scan_here(struct sched_s *s, struct sched_dir_s *d)
+{
+    struct walk_s w;
+
+    walk_init(s->x, &w);
+    w.anc_lock = &s->lock;
+    w.root_dev = d->root_dev;
+    w.root_len = d->root_len;
+    if (!SFILE_STOPPED(s->x))
+        walk_dlist(s->x, &w, d->path, d->anc);
+    else
+        ancestor_release(d->anc, w.anc_lock);
+    walk_free(&w);
+    xfree(d->path);
+    xfree(d);
+}
+
+static void *
+sched_worker(void *data)
+{
+    size_t j;
+    struct sched_dev_s *sd = data;
+    struct sched_s *s = sd->s;
+    struct sched_dir_s *d = NULL;
+    struct walk_s w;
+
+    walk_init(s->x, &w);
+    w.sched = s;
+    w.anc_lock = &s->lock;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        /* a root may still be pushed until the scheduler is closed */
+        while (!sd->head && (s->pending || !s->closed))
+            pthread_cond_wait(&sd->cond, &s->lock);
+        if (!sd->head)
+            break;
+        d = sd->head;
+        sd->head = d->next;
+        pthread_mutex_unlock(&s->lock);
+
+        if (!SFILE_STOPPED(s->x)) {
+            w.root_dev = d->root_dev;
+            w.root_len = d->root_len;
+            w.anc = d->anc;
+            scan_dir(s->x, &w, d->path);
+            w.anc = NULL;
+        }
+        ancestor_release(d->anc, w.anc_lock);
+        xfree(d->path);
+        xfree(d);
+
+        pthread_mutex_lock(&s->lock);
+        if (!--s->pending) {
+            for (j = 0; j < s->n_devs; j++)
+                pthread_cond_broadcast(&s->devs[j]->cond);
+            pthread_cond_signal(&s->done);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    walk_free(&w);
+    trace_thread_exit(s->x);
+    summary_thread_exit();
+    return NULL;
+}
+
+/*
+ * Number of threads for a device: x->n_jobs, or for a network file
+ * system (2) and a rotational disk (1) x->n_slow_jobs if set.
+ */
+static int
+dev_jobs(struct sfile_ctx_s *x, const char *path, dev_t dev)
+{
+    int slow;
+#ifndef MACOS
+    FILE *file = NULL;
+    char buf[128];
+    struct statfs sfs;
+    const struct fstype_s *p_fs = NULL;
+    static const char *net_fstype[] =
+         {"nfs", "cifs", "smb2", "ceph", "9p", NULL};
+    const char **p_net = NULL;
+#endif /* !MACOS */
+
+    slow = 0;
+#ifndef MACOS
+    if (!statfs(path, &sfs)) {
+        for (p_net = net_fstype; *p_net && !slow; p_net++) {
+            for (p_fs = tab_fstype; p_fs->name; p_fs++) {
+                if (!strcmp(p_fs->name, *p_net) &&
+                    (long) sfs.f_type == p_fs->magic)
+                    slow = 2;
+            }
+        }
+    }
+    if (!slow) {
+        /* queue of the disk, or of the parent disk for a partition */
+        snprintf(buf, sizeof(buf), "/sys/dev/block/%u:%u/queue/rotational",
+                 major(dev), minor(dev));
+        file = fopen(buf, "r");
+        if (!file) {
+            snprintf(buf, sizeof(buf),
+                     "/sys/dev/block/%u:%u/../queue/rotational",
+                     major(dev), minor(dev));
+            file = fopen(buf, "r");
+        }
+        if (file) {
+            if (fgetc(file) == '1')
+                slow = 1;
+            fclose(file);
+        }
+    }
+#else
+    (void) path;
+    (void) dev;
+#endif /* !MACOS */
+    if (slow)
+        return x->n_slow_jobs ? x->n_slow_jobs : slow;
+    return x->n_jobs;
+}
+
+/* '.' entries only with -a, never '.' and '..', and -o filter */
+static int
+keep_dir_entry(struct sfile_ctx_s *x, const char *name)
+{
+    return ((name[0] != '.' ||
+             (name[0] == '.' && (x->opts & O_ALL) &&
+              strcmp(name, ".") &&
+              strcmp(name, ".."))) &&
+            (!x->ign || (x->ign && !strstr(name, x->ign))));
+}
+
+/*
+ * Check one entry of the directory dfd (w->path) and push it in
+ * directory list in recursive mode. If st is not NULL, it is the
+ * lstat() of the entry. The name replaces the last entry in w->path.
+ */
+static void
+list_dir_entry(struct sfile_ctx_s *x, struct walk_s *w, int dfd,
+               const char *name, const struct stat *st)
+{
+    int keep;
+    int descend;
+    size_t len;
+    struct finfo_s fi;
+
+    len = strlen(name);
+    walk_path_reserve(w, w->path_len + len);
+    memcpy(w->path + w->path_len, name, len + 1);
+    fi.fi_path = w->path;
+    fi.fi_name = w->path + w->path_len;
+    fi.fi_root = w->root_len;
+    fi.fi_dfd = dfd;
+    keep = 1;
+    descend = 1;
+    if (x->shard_n)
+        keep = shard_keep(x, w, fi.fi_path, &descend);
+    if (st) {
+        fi.fi_stat = *st;
+        fi.fi_type = stat_file_type(&fi);
+        if (keep)
+            filter_object(x, &fi);
+    }
+    else if (keep)
+        check_object(x, &fi);
+    /* entry of other shard, but its subtree can be ours */
+    else if (descend && (x->opts & O_RECURSIVE))
+        fi.fi_type = get_file_type(x, &fi);
+    else
+        return;
+    if (!descend || fi.fi_type != TF_DIR || !(x->opts & O_RECURSIVE) ||
+        !descend_dir(x, w, &fi))
+        return;
+    if (w->sched)
+        sched_push(w->sched, fi.fi_path, fi.fi_stat.st_dev, w->root_dev,
+                   w->root_len,
+                   ancestor_new(x, w->anc, w->anc_lock, &fi.fi_stat));
+    else
+        push_dir_stack(&w->dlist, fi.fi_path,
+                       ancestor_new(x, w->anc, w->anc_lock, &fi.fi_stat),
+                       (x->opts & O_FIRST_FAST));
+}
+
+/*
+ * --inode-order: read all entries of dir, sort them by inode number,
+ * lstat() them in this order, then check them (and open files for -i)
+ * in the same order. The next SFILE_PREFETCH files to search are
+ * announced to the kernel with posix_fadvise(WILLNEED).
+ * --first-fast: check entries with a matching name first, then by
+ * size, so the first results come without reading big files.
+ */
+static void
+list_dir_batch(struct sfile_ctx_s *x, struct walk_s *w, DIR *dir)
+{
+    int dfd;
+    int reads;
+    double t;
+    size_t i;
+    size_t len;
+    size_t prefetch;
+    struct dirent *ent = NULL;
+    struct batch_s *b = &w->batch;
+    struct batch_entry_s *be = NULL;
+
+    TRACE_BEGIN(x, readdir, w->path, t);
+    b->count = 0;
+    b->names_len = 0;
+    while ((ent = readdir(dir))) {
+        if (!keep_dir_entry(x, ent->d_name))
+            continue;
+        if (b->count == b->size) {
+            b->size = b->size ? b->size * 2 : 256;
+            b->ent = realloc(b->ent, b->size * sizeof(struct batch_entry_s));
+            if (!b->ent)
+                out_memory("realloc");
+        }
+        len = strlen(ent->d_name) + 1;
+        if (b->names_len + len > b->names_size) {
+            while (b->names_len + len > b->names_size)
+                b->names_size = b->names_size ? b->names_size * 2 : 4096;
+            b->names = realloc(b->names, b->names_size);
+            if (!b->names)
+                out_memory("realloc");
+        }
+        memcpy(b->names + b->names_len, ent->d_name, len);
+        b->ent[b->count].ino = ent->d_ino;
+        b->ent[b->count].name = b->names_len;
+        b->names_len += len;
+        b->count++;
+    }
+    TRACE_END(x, readdir, w->path, t);
+    qsort(b->ent, b->count, sizeof(struct batch_entry_s), cmp_batch_inode);
+
+    dfd = dirfd(dir);
+    for (i = 0; i < b->count; i++) {
+        be = &b->ent[i];
+        throttle_io(x, 1, 0);
+        TRACE_BEGIN(x, stat, b->names + be->name, t);
+        be->stat_ok = !fstatat(dfd, b->names + be->name, &be->st,
+                               (x->opts & O_FOLLOW_LINK) ?
+                               0 : AT_SYMLINK_NOFOLLOW);
+        /* broken link with --follow */
+        if (!be->stat_ok && (x->opts & O_FOLLOW_LINK))
+            be->stat_ok = !fstatat(dfd, b->names + be->name, &be->st,
+                                   AT_SYMLINK_NOFOLLOW);
+        TRACE_END(x, stat, b->names + be->name, t);
+        if (!be->stat_ok)
+            fprintf(stderr, "%s:lstat:path `%s%s': %s\n", x->prog_name,
+                    w->path, b->names + be->name, strerror(errno));
+        be->rank = !name_match(x, b->names + be->name);
+    }
+    if ((x->opts & O_FIRST_FAST))
+        qsort(b->ent, b->count, sizeof(struct batch_entry_s),
+              cmp_batch_first);
+
+    prefetch = 0;
+    reads = reads_files(x);
+    for (i = 0; i < b->count && !SFILE_STOPPED(x); i++) {
+        if (reads) {
+            if (prefetch <= i)
+                prefetch = i + 1;
+            for (; prefetch < b->count && prefetch <= i + SFILE_PREFETCH;
+                 prefetch++)
+                prefetch_file(dfd, &b->ent[prefetch], b->names);
+        }
+        be = &b->ent[i];
+        if (be->stat_ok)
+            list_dir_entry(x, w, dfd, b->names + be->name, &be->st);
+    }
+}
+
+static int
+cmp_batch_inode(const void *a, const void *b)
+{
+    ino_t ia = ((const struct batch_entry_s *) a)->ino;
+    ino_t ib = ((const struct batch_entry_s *) b)->ino;
+
+    return (ia > ib) - (ia < ib);
+}
+
+/* --first-fast order: name matches, then small entries */
+static int
+cmp_batch_first(const void *a, const void *b)
+{
+    const struct batch_entry_s *ea = a;
+    const struct batch_entry_s *eb = b;
+
+    if (ea->rank != eb->rank)
+        return ea->rank - eb->rank;
+    if (ea->st.st_size != eb->st.st_size)
+        return (ea->st.st_size > eb->st.st_size) -
+               (ea->st.st_size < eb->st.st_size);
+    return (ea->ino > eb->ino) - (ea->ino < eb->ino);
+}
+
+/* name is a result for -e, -n or -N */
+static int
+name_match(struct sfile_ctx_s *x, const char *name)
+{
+    return ((x->ext && !cmp_file_extension(name, x->ext)) ||
+            (x->win && win_match(x, name)) ||
+            (x->wnf && wnf_match(x, name)));
+}
+
+/* x->win is in name, folded with --ign-case-file-name */
+static int
+win_match(const struct sfile_ctx_s *x, const char *name)
+{
+    if (x->fold_win)
+        return fold_find(x->fold_win, name, strlen(name), NULL) != NULL;
+    return x->searchstring_win(name, x->win) != NULL;
+}
+
+/* name is x->wnf, folded with --ign-case-file-name */
+static int
+wnf_match(const struct sfile_ctx_s *x, const char *name)
+{
+    if (x->fold_wnf)
+        return fold_equal(x->fold_wnf, name);
+    return !x->cmpstring_wnf(x->wnf, name);
+}
+
+/* start read ahead of a regular file */
+static void
+prefetch_file(int dfd, const struct batch_entry_s *be, const char *names)
+{
+#ifdef POSIX_FADV_WILLNEED
+    int fd;
+
+    if (!be->stat_ok || !S_ISREG(be->st.st_mode) || !be->st.st_size)
+        return;
+    fd = openat(dfd, names + be->name, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    if (fd == -1)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void) dfd;
+    (void) be;
+    (void) names;
+#endif /* POSIX_FADV_WILLNEED */
+}
+
+/*
+ * Check if a directory found in recursive mode can be scanned:
+ * --one-file-system, --skip-fstype and loops with --follow (fi is
+ * the directory in scan or one of its parents).
+ */
+static int
+descend_dir(struct sfile_ctx_s *x, struct walk_s *w, struct finfo_s *fi)
+{
+    const struct ancestor_s *anc = NULL;
+
+    if ((x->opts & O_ONE_FS) && fi->fi_stat.st_dev != w->root_dev)
+        return 0;
+    if (x->skip_fstype &&
+        fstype_is_skipped(x, fi->fi_path, fi->fi_stat.st_dev))
+        return 0;
+    /* the chain is kept by w->anc, it does not change */
+    for (anc = w->anc; anc; anc = anc->parent) {
+        if (anc->ino == fi->fi_stat.st_ino && anc->dev == fi->fi_stat.st_dev)
+            return 0;
+    }
+    return 1;
+}
+
+/* statfs() is called once by device */
+static int
+fstype_is_skipped(struct sfile_ctx_s *x, const char *path, dev_t dev)
+{
+    int skip;
+    size_t i;
+
+    pthread_mutex_lock(&x->dev_lock);
+    for (i = 0; i < x->n_dev_cache; i++) {
+        if (x->dev_cache[i].dev == dev) {
+            skip = x->dev_cache[i].skip;
+            pthread_mutex_unlock(&x->dev_lock);
+            return skip;
+        }
+    }
+    pthread_mutex_unlock(&x->dev_lock);
+
+    skip = fstype_match(x, path);
+    pthread_mutex_lock(&x->dev_lock);
+    /* 8 devices by allocation */
+    if (!(x->n_dev_cache % 8)) {
+        x->dev_cache = realloc(x->dev_cache, (x->n_dev_cache + 8) *
+                               sizeof(struct sfile_devcache_s));
+        if (!x->dev_cache)
+            out_memory("realloc");
+    }
+    x->dev_cache[x->n_dev_cache].dev = dev;
+    x->dev_cache[x->n_dev_cache].skip = skip;
+    x->n_dev_cache++;
+    pthread_mutex_unlock(&x->dev_lock);
+    return skip;
+}
+
+/* return 1 if file system of path is in x->skip_fstype */
+static int
+fstype_match(struct sfile_ctx_s *x, const char *path)
+{
+    char **p_name = NULL;
+    struct statfs sfs;
+#ifndef MACOS
+    const struct fstype_s *p_fs = NULL;
+#endif /* !MACOS */
+
+    if (statfs(path, &sfs) == -1) {
+        fprintf(stderr, "%s:statfs: path `%s': %s\n", x->prog_name,
+                path, strerror(errno));
+        return 0;
+    }
+    for (p_name = x->skip_fstype; *p_name; p_name++) {
+#ifdef MACOS
+        if (!strcmp(sfs.f_fstypename, *p_name))
+            return 1;
+#else
+        for (p_fs = tab_fstype; p_fs->name; p_fs++) {
+            if (!strcmp(p_fs->name, *p_name) &&
+                (long) sfs.f_type == p_fs->magic)
+                return 1;
+        }
+#endif /* MACOS */
+    }
+    return 0;
+}
+
+/*
+ * --shard: return 1 if this shard checks the entry. Directories are
+ * read by all shards, except at --shard-depth where the entry and
+ * its subtree go to one shard (*descend is 0 for the others).
+ */
+static int
+shard_keep(struct sfile_ctx_s *x, struct walk_s *w, const char *path,
+           int *descend)
+{
+    int depth;
+    const char *p = NULL;
+    const char *rel = NULL;
+
+    rel = path + w->root_len;
+    while (*rel == '/')
+        rel++;
+    *descend = 1;
+    if (x->shard_depth > 0) {
+        depth = 1;
+        for (p = rel; *p && depth <= x->shard_depth; p++) {
+            if (*p == '/')
+                depth++;
+        }
+        /* in a subtree of this shard */
+        if (depth > x->shard_depth)
+            return 1;
+        if (depth == x->shard_depth) {
+            *descend = (shard_of(x, rel) == x->shard_i);
+            return *descend;
+        }
+    }
+    return shard_of(x, rel) == x->shard_i;
+}
+
+/* shard of a path relative to the scanned path, FNV-1a hash */
+static int
+shard_of(struct sfile_ctx_s *x, const char *path)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (; *path; path++) {
+        hash ^= (unsigned char) *path;
+        hash *= 0x100000001b3ULL;
+    }
+    return (int) (hash % (uint64_t) x->shard_n);
+}
+
+/* --follow: node of a directory to scan below parent, else NULL */
+static struct ancestor_s *
+ancestor_new(struct sfile_ctx_s *x, struct ancestor_s *parent,
+             pthread_mutex_t *lock, const struct stat *st)
+{
+    struct ancestor_s *anc = NULL;
+
+    if (!(x->opts & O_FOLLOW_LINK))
+        return NULL;
+    anc = xmalloc(sizeof(struct ancestor_s));
+    anc->dev = st->st_dev;
+    anc->ino = st->st_ino;
+    anc->refs = 1;
+    anc->parent = parent;
+    if (parent) {
+        if (lock)
+            pthread_mutex_lock(lock);
+        parent->refs++;
+        if (lock)
+            pthread_mutex_unlock(lock);
+    }
+    return anc;
+}
+
+/* drop a reference of anc, and of its parents freed with it */
+static void
+ancestor_release(struct ancestor_s *anc, pthread_mutex_t *lock)
+{
+    struct ancestor_s *parent = NULL;
+
+    if (!anc)
+        return;
+    if (lock)
+        pthread_mutex_lock(lock);
+    while (anc && !--anc->refs) {
+        parent = anc->parent;
+        xfree(anc);
+        anc = parent;
+    }
+    if (lock)
+        pthread_mutex_unlock(lock);
+}
+
+/* return 1 if object is a result */
+static int
+check_object(struct sfile_ctx_s *x, struct finfo_s *fi)
+{
+    fi->fi_type = get_file_type(x, fi);
+    if (fi->fi_type == TF_ERROR)
+        return 0;
+    return filter_object(x, fi);
+}
+
+/*
+ * Check object with fi_stat and fi_type set. With --cache-first,
+ * a file to search not in page cache is checked later by a cold
+ * reader.
+ */
+static int
+filter_object(struct sfile_ctx_s *x, struct finfo_s *fi)
+{
+    int fd;
+    int match;
+    struct fbuf_s fb;
+
+    if (!x->cold)
+        return filter_object_mode(x, fi, NULL);
+    if (cold_defer(x, fi, &fd))
+        return 0;
+    if (fd == -1)
+        return filter_object_mode(x, fi, NULL);
+    /* searched now with the fd of the cache probe */
+    fbuf_init(&fb, fd);
+    match = filter_object_mode(x, fi, &fb);
+    fbuf_close(x, &fb);
+    return match;
+}
+
+/* version of filter_object_mask() selected by sfile_prepare() */
+static int
+filter_object_mode(struct sfile_ctx_s *x, struct finfo_s *fi,
+                   struct fbuf_s *fb)
+{
+    switch (x->filter_mode) {
+    case FILTER_LS:
+        return filter_object_mask(x, fi, F_LS, fb);
+    case FILTER_EXT:
+        return filter_object_mask(x, fi, F_EXT, fb);
+    case FILTER_WIN:
+        return filter_object_mask(x, fi, F_WIN, fb);
+    case FILTER_WIN_ICASE:
+        return filter_object_mask(x, fi, F_WIN | F_ICASE, fb);
+    case FILTER_WNF:
+        return filter_object_mask(x, fi, F_WNF, fb);
+    case FILTER_WNF_ICASE:
+        return filter_object_mask(x, fi, F_WNF | F_ICASE, fb);
+    case FILTER_WIF:
+        return filter_object_mask(x, fi, F_WIF, fb);
+    case FILTER_QUERIES:
+        return filter_queries(x, fi, fb);
+    default:
+        return filter_object_mask(x, fi, F_GENERIC, fb);
+    }
+}
+
+/*
+ * --queries: check fi with each query not stopped. The file is read
+ * once, by the first query searching in it, and closed after the
+ * last query. The scan stops when all queries are stopped.
+ */
+static int
+filter_queries(struct sfile_ctx_s *x, struct finfo_s *fi,
+               struct fbuf_s *shared)
+{
+    int found;
+    int active;
+    size_t i;
+    struct fbuf_s local;
+    struct fbuf_s *fb = shared ? shared : &local;
+    struct sfile_ctx_s *q = NULL;
+
+    if (!shared)
+        fbuf_init(&local, -1);
+    found = 0;
+    active = 0;
+    for (i = 0; i < x->n_queries; i++) {
+        q = x->queries[i];
+        if (SFILE_STOPPED(q))
+            continue;
+        found |= filter_object_mask(q, fi, F_GENERIC, fb);
+        active |= !SFILE_STOPPED(q);
+    }
+    if (!shared)
+        fbuf_close(x, &local);
+    if (!active)
+        atomic_store(&x->stop, 1);
+    return found;
+}
+
+/* x or one of its queries searches in files */
+static int
+reads_files(const struct sfile_ctx_s *x)
+{
+    size_t i;
+
+    for (i = 0; i < x->n_queries; i++) {
+        if (x->queries[i]->wif)
+            return 1;
+    }
+    return x->wif != NULL;
+}
+
+/*
+ * mask is a constant: each call of this inlined function is compiled
+ * without the tests of the options not in mask. F_GENERIC tests all
+ * options and calls the matchers by pointer.
+ * shared is the file read by the queries of the scan, or opened by
+ * the cache probe, closed by the caller, else NULL.
+ */
+static inline int
+filter_object_mask(struct sfile_ctx_s *x, struct finfo_s *fi, unsigned mask,
+                   struct fbuf_s *shared)
+{
+    int match;
+    struct fbuf_s local;
+    struct fbuf_s *fb = shared ? shared : &local;
+    struct sfile_result_s res;
+    struct stack_s lines;
+
+    /* check filter */
+    if ((mask & F_GENERIC) &&
+        ( /* check ignore file type */
+         (fi->fi_type == TF_BACKUP && (x->opts & O_IGN_BACKUP)) ||
+         (fi->fi_type == TF_DIR && (x->opts & O_IGN_DIR)) ||
+         (fi->fi_type == TF_REG && (x->opts & O_IGN_FILE)) ||
+         (fi->fi_type == TF_ARCHIVE && (x->opts & O_IGN_ARCHIVE)) ||
+         /* check ignore and ignore by extension */
+         (x->ign_ext && !ign_file_extension(fi->fi_name, x->ign_ext))))
+        return 0;
+
+    res.n_match = 0;
+    lines.chunk = NULL;
+    lines.tail = NULL;
+    if (!shared)
+        fbuf_init(&local, -1);
+    if ((mask & F_GENERIC))
+        match = (/* ls mode, list all file by default */
+                 (x->opts & O_LS_MODE) ||
+                 /* search by uid */
+                 (x->byuid == (int) fi->fi_stat.st_uid) ||
+                 /* is file inode ? */
+                 (x->byino == (int) fi->fi_stat.st_ino) ||
+                 /* search by file extension */
+                 (x->ext && !cmp_file_extension(fi->fi_name, x->ext)) ||
+                 /* search word in file name */
+                 (x->win && win_match(x, fi->fi_name)) ||
+                 /* compar file name */
+                 (x->wnf && wnf_match(x, fi->fi_name)) ||
+                 /* search word in file */
+                 (x->wif && !word_in_file(x, fi, &res, &lines, fb)));
+    else if ((mask & F_LS))
+        match = 1;
+    else if ((mask & F_EXT))
+        match = !cmp_file_extension(fi->fi_name, x->ext);
+    else if ((mask & F_WIN))
+        match = ((mask & F_ICASE) ?
+                 fold_find(x->fold_win, fi->fi_name, strlen(fi->fi_name),
+                           NULL) :
+                 strstr(fi->fi_name, x->win)) != NULL;
+    else if ((mask & F_WNF))
+        match = ((mask & F_ICASE) ? fold_equal(x->fold_wnf, fi->fi_name) :
+                 !strcmp(x->wnf, fi->fi_name));
+    else
+        match = !word_in_file(x, fi, &res, &lines, fb);
+
+    /* --estimate, --fuzzy-name and --summary, given by sfile_finish() */
+    if (match && (mask & F_GENERIC) && x->sample)
+        sample_add(x, res.n_match);
+    else if (match && (mask & F_GENERIC) && x->fuzzy)
+        match = fuzzy_add(x, fi);
+    else if (match && (mask & F_GENERIC) && x->summary)
+        summary_add(x, fi, res.n_match);
+    else if (match)
+        match = report_object(x, fi, &res, &lines);
+    if ((mask & (F_GENERIC | F_WIF))) {
+        free_line_stack(lines.chunk);
+        if (!shared)
+            fbuf_close(x, fb);
+    }
+    return match;
+}
+
+/* give a result to the callback, return 1 if n_exit is not reached */
+static int
+report_object(struct sfile_ctx_s *x, struct finfo_s *fi,
+              struct sfile_result_s *res, struct stack_s *lines)
+{
+    int found;
+    pthread_mutex_t *lock = NULL;
+
+    res->path = fi->fi_path;
+    res->name = fi->fi_name;
+    res->type = fi->fi_type;
+    res->st = &fi->fi_stat;
+    res->lines = lines->chunk;
+    found = 0;
+    /* the queries of a scan can share an output */
+    lock = &WALK_CTX(x)->lock;
+    pthread_mutex_lock(lock);
+    /* other worker can reach n_exit before us */
+    if (x->n_exit) {
+        found = 1;
+        if (x->result_cb && x->result_cb(res, x->result_data))
+            x->n_exit = 0;
+        else
+            x->n_exit--;
+        if (!x->n_exit)
+            atomic_store(&x->stop, 1);
+    }
+    pthread_mutex_unlock(lock);
+    return found;
+}
+
+static int
+ign_file_extension(const char *name, char **ext)
+{
+    char *buf = NULL;
+    char **p_ext = NULL;
+
+    buf = strrchr(name, '.');
+    if (!buf)
+        return -1;
+
+    p_ext = ext;
+    while (*p_ext) {
+        if (!strcmp(buf, *p_ext))
+            return 0;
+        p_ext++;
+    }
+    return -1;
+}
+
+static int
+cmp_file_extension(const char *name, const char *ext)
+{
+    char *buf = NULL;
+
+    buf = strrchr(name, '.');
+    return (buf && !strcmp(buf, ext)) ? 0 : -1;
+}
+
+/*
+ * Search x->wif in the file. The lines pushed in lines point in fb,
+ * which is closed after the result callback.
+ * With --before and --after, context lines are pushed around the
+ * printed lines. They never go before the last line pushed, so the
+ * windows are merged, and the lines before a match are found backward
+ * in the buffer, without keep the offsets of all lines.
+ */
+static int
+word_in_file(struct sfile_ctx_s *x, const struct finfo_s *fi,
+             struct sfile_result_s *res, struct stack_s *lines,
+             struct fbuf_s *fb)
+{
+    int k;
+    int text;
+    int record;
+    double t;
+    int after;
+    int before;
+    long n_lines;
+    size_t i;
+    size_t len;
+    size_t pos;
+    size_t scan;
+    size_t off;
+    size_t start;
+    size_t match_len;
+    const char *buf = NULL;
+    const char *match = NULL;
+
+    /* file already read by an other query */
+    if (!fb->state)
+        fb->state = fbuf_open(WALK_CTX(x), fi, fb) ? -1 : 1;
+    if (fb->state == -1)
+        return -1;
+    TRACE_BEGIN(WALK_CTX(x), search, fi->fi_path, t);
+
+    buf = fb->data;
+    /* a folded match can be longer than the needle */
+    len = x->fold_wif ? x->fold_wif->max_len : strlen(x->wif);
+    text = ((x->opts & O_PRINT) || (x->opts & O_ALL_PRINT));
+    record = (text || (x->opts & O_NUM_LINE));
+    before = text ? x->before_ctx : 0;
+    after = 0;
+    n_lines = 1;  /* line number of pos */
+    pos = 0;      /* first line not pushed or counted */
+    scan = 0;
+    while ((match = search_file(x, fb, &scan, len, &match_len))) {
+        off = (size_t) (match - buf);
+        start = off;
+        while (start > pos && buf[start - 1] != '\n')
+            start--;
+
+        /* after context of the last match */
+        for (; after > 0 && pos < start; after--)
+            pos = push_context_line(lines, fb, pos, n_lines++);
+        if (record)
+            n_lines += count_lines(buf + pos, start - pos);
+
+        /* before context, from the last line pushed */
+        for (i = start, k = 0; k < before && i > pos; k++) {
+            for (i--; i > pos && buf[i - 1] != '\n'; i--)
+                continue;
+        }
+        for (; i < start; k--)
+            i = push_context_line(lines, fb, i, n_lines - k);
+
+        res->n_match++;
+        pos = next_line(fb, start);
+        if (record) {
+            push_line_stack(lines, text ? buf + start : NULL,
+                            line_len(fb, start, pos), n_lines,
+                            (long) off, off - start, match_len, 0);
+        }
+        n_lines++;
+        scan = pos;
+        after = text ? x->after_ctx : 0;
+        if (!(x->opts & O_ALL_PRINT) && !(x->opts & O_WIF_COUNT))
+            break;
+    }
+    for (; after > 0 && pos < fb->len; after--)
+        pos = push_context_line(lines, fb, pos, n_lines++);
+    TRACE_END(WALK_CTX(x), search, fi->fi_path, t);
+
+    return res->n_match ? 0 : -1;
+}
+
+/*
+ * Next match from *scan, of *match_len bytes. With --max-read-rate, a mapped file is
+ * searched by SFILE_THROTTLE_CHUNK bytes.
+ */
+static const char *
+search_file(struct sfile_ctx_s *x, const struct fbuf_s *fb, size_t *scan,
+            size_t len, size_t *match_len)
+{
+    size_t end;
+    size_t size;
+    size_t chunk;
+    const char *match = NULL;
+    struct sfile_ctx_s *io = WALK_CTX(x);
+
+    chunk = (fb->mapped && io->throttle.enabled) ?
+        SFILE_THROTTLE_CHUNK : fb->len;
+    while (*scan < fb->len) {
+        end = (fb->len - *scan > chunk) ? *scan + chunk : fb->len;
+        /* a match can begin before end and finish after it */
+        size = ((fb->len - end > len) ? end + len : fb->len) - *scan;
+        if (x->fold_wif)
+            match = fold_find(x->fold_wif, fb->data + *scan, size,
+                              match_len);
+        else {
+            match = x->searchmem_wif(fb->data + *scan, size, x->wif, len);
+            *match_len = len;
+        }
+        if (match)
+            return match;
+        if (fb->mapped)
+            throttle_io(io, 1, (double) (end - *scan));
+        *scan = end;
+    }
+    return NULL;
+}
+
+static size_t
+push_context_line(struct stack_s *lines, const struct fbuf_s *fb, size_t pos,
+                  long n)
+{
+    size_t next;
+
+    next = next_line(fb, pos);
+    push_line_stack(lines, fb->data + pos, line_len(fb, pos, next), n,
+                    (long) pos, 0, 0, 1);
+    return next;
+}
+
+/* offset of the line after the line at pos */
+static size_t
+next_line(const struct fbuf_s *fb, size_t pos)
+{
+    const char *eol = NULL;
+
+    eol = memchr(fb->data + pos, '\n', fb->len - pos);
+    return eol ? (size_t) (eol - fb->data) + 1 : fb->len;
+}
+
+/* length of the line without '\n' */
+static size_t
+line_len(const struct fbuf_s *fb, size_t pos, size_t next)
+{
+    if (next > pos && fb->data[next - 1] == '\n')
+        next--;
+    return next - pos;
+}
+
+static long
+count_lines(const char *buf, size_t len)
+{
+    long n;
+    const char *end = buf + len;
+
+    for (n = 0; (buf = memchr(buf, '\n', (size_t) (end - buf))); n++)
+        buf++;
+    return n;
+}
+
+static char *
+mem_search(const char *mem, size_t mem_len, const char *str, size_t len)
+{
+    return memmem(mem, mem_len, str, len);
+}
+
+/*
+ * Map a regular file, else read it (pipe, file of /proc,
+ * mmap() error).
+ */
+static int
+fbuf_open(struct sfile_ctx_s *x, const struct finfo_s *fi, struct fbuf_s *fb)
+{
+    double t;
+    ssize_t ret;
+    size_t size;
+    struct stat st;
+
+    fb->mapped = 0;
+    fb->data = NULL;
+    fb->len = 0;
+    /* fd of the cache probe, else open now */
+    if (fb->fd == -1)
+        fb->fd = open_read_file(x, fi, 1);
+    if (fb->fd == -1)
+        return -1;
+    TRACE_BEGIN(x, read, fi->fi_path, t);
+    /*
+     * A mapped file cut during the search (log rotation) sends SIGBUS,
+     * a file which can still change is read.
+     */
+    if (!fstat(fb->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        file_is_settled(&st)) {
+        fb->data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+                        fb->fd, 0);
+        if (fb->data != MAP_FAILED) {
+            fb->mapped = 1;
+            fb->len = (size_t) st.st_size;
+#ifdef MADV_SEQUENTIAL
+            madvise(fb->data, fb->len, MADV_SEQUENTIAL);
+#endif /* MADV_SEQUENTIAL */
+            TRACE_END(x, read, fi->fi_path, t);
+            return 0;
+        }
+        fb->data = NULL;
+    }
+
+    size = 0;
+    for (;;) {
+        if (fb->len == size) {
+            size = size ? size * 2 : LINE_BUFSIZE;
+            fb->data = realloc(fb->data, size);
+            if (!fb->data)
+                out_memory("realloc");
+        }
+        ret = read(fb->fd, fb->data + fb->len, size - fb->len);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        /* read error (directory): no match */
+        if (ret <= 0)
+            break;
+        fb->len += (size_t) ret;
+        throttle_io(x, 1, (double) ret);
+    }
+    TRACE_END(x, read, fi->fi_path, t);
+    return 0;
+}
+
+/* fd is -1, or a file to read by fbuf_open() */
+static void
+fbuf_init(struct fbuf_s *fb, int fd)
+{
+    fb->state = 0;
+    fb->fd = fd;
+    fb->mapped = 0;
+    fb->data = NULL;
+    fb->len = 0;
+}
+
+/* st not changed (data or size) for SFILE_MMAP_AGE seconds */
+static int
+file_is_settled(const struct stat *st)
+{
+    time_t now;
+
+    now = time(NULL);
+    return st->st_mtime <= now - SFILE_MMAP_AGE &&
+        st->st_ctime <= now - SFILE_MMAP_AGE;
+}
+
+static void
+fbuf_close(struct sfile_ctx_s *x, struct fbuf_s *fb)
+{
+    if (fb->mapped)
+        munmap(fb->data, fb->len);
+    else
+        xfree(fb->data);
+    fb->data = NULL;
+    fb->mapped = 0;
+    if (fb->fd != -1)
+        close_read_file(x, fb->fd);
+    fb->fd = -1;
+    fb->state = 0;
+}
+
+/*
+ * openat() of fi. Without directory fd, a full path longer than
+ * PATH_MAX is opened one component at a time.
+ */
+static int
+open_object(const struct finfo_s *fi, int flags)
+{
+    int fd;
+
+    fd = openat(fi->fi_dfd, FI_AT(fi), flags);
+    if (fd == -1 && errno == ENAMETOOLONG && fi->fi_dfd == AT_FDCWD)
+        fd = open_long_path(fi->fi_path, flags);
+    return fd;
+}
+
+/*
+ * Open file for word_in_file(), with --noatime and --drop-cache. An
+ * error is printed if report is set.
+ */
+static int
+open_read_file(struct sfile_ctx_s *x, const struct finfo_s *fi, int report)
+{
+    int fd;
+    int flags;
+    double t;
+
+    throttle_io(x, 1, 0);
+    TRACE_BEGIN(x, open, fi->fi_path, t);
+    flags = O_RDONLY | O_NOCTTY;
+#ifdef O_NOATIME
+    if ((x->opts & O_READ_NOATIME))
+        flags |= O_NOATIME;
+#endif /* O_NOATIME */
+    fd = open_object(fi, flags);
+#ifdef O_NOATIME
+    /* O_NOATIME only for owner of the file */
+    if (fd == -1 && errno == EPERM && (flags & O_NOATIME))
+        fd = open_object(fi, flags & ~O_NOATIME);
+#endif /* O_NOATIME */
+    TRACE_END(x, open, fi->fi_path, t);
+    if (fd == -1) {
+        if (report)
+            fprintf(stderr, "%s:open `%s': %s\n",
+                    x->prog_name, fi->fi_path, strerror(errno));
+        return -1;
+    }
+#ifdef POSIX_FADV_NOREUSE
+    if ((x->opts & O_READ_NOCACHE))
+        posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+#endif /* POSIX_FADV_NOREUSE */
+    return fd;
+}
+
+static void
+close_read_file(struct sfile_ctx_s *x, int fd)
+{
+#ifdef POSIX_FADV_DONTNEED
+    if ((x->opts & O_READ_NOCACHE))
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    (void) x;
+#endif /* POSIX_FADV_DONTNEED */
+    close(fd);
+}
+
+/*
+ * Version of filter_object() for the options: one search without
+ * filter of type, uid or inode, else the generic version.
+ */
+static int
+filter_mode(struct sfile_ctx_s *x)
+{
+    int n_search;
+
+    if ((x->opts & (O_IGN_BACKUP | O_IGN_DIR | O_IGN_FILE |
+                    O_IGN_ARCHIVE)) ||
+        x->ign_ext || x->byuid != -1 || x->byino != -1 || x->fuzzy ||
+        x->summary_depth >= 0 || x->sample)
+        return FILTER_GENERIC;
+    if ((x->opts & O_LS_MODE))
+        return FILTER_LS;
+    n_search = !!x->ext + !!x->win + !!x->wnf + !!x->wif;
+    if (n_search != 1)
+        return FILTER_GENERIC;
+    if (x->ext)
+        return FILTER_EXT;
+    if (x->win)
+        return (x->opts & O_IGN_CASE_FILE_NAME) ?
+            FILTER_WIN_ICASE : FILTER_WIN;
+    if (x->wnf)
+        return (x->opts & O_IGN_CASE_FILE_NAME) ?
+            FILTER_WNF_ICASE : FILTER_WNF;
+    return FILTER_WIF;
+}
+
+/*
+ * --cache-first: queue fi for the cold readers if it is a file to
+ * search and its first bytes are not in page cache. The queue is
+ * bounded, a file is searched now if it is full or if no reader
+ * starts. Else than queued, *fd is the file opened by the probe to
+ * search now, or -1.
+ */
+static int
+cold_defer(struct sfile_ctx_s *x, const struct finfo_s *fi, int *fd)
+{
+    struct sfile_cold_s *cold = x->cold;
+    struct cold_entry_s *e = NULL;
+
+    *fd = -1;
+    if (!S_ISREG(fi->fi_stat.st_mode) || fi->fi_stat.st_size <= 0 ||
+        !reads_files(x) || SFILE_STOPPED(x) || file_cached(x, fi, fd))
+        return 0;
+
+    pthread_mutex_lock(&cold->lock);
+    if (cold->count >= cold->max || cold->no_reader ||
+        (!cold->n_threads && !cold_start(x))) {
+        pthread_mutex_unlock(&cold->lock);
+        return 0;
+    }
+    e = xmalloc(sizeof(struct cold_entry_s));
+    e->fd = *fd;
+    *fd = -1;
+    e->path = xstrdup(fi->fi_path);
+    e->root = fi->fi_root;
+    e->type = fi->fi_type;
+    e->st = fi->fi_stat;
+    e->next = NULL;
+    if (cold->tail)
+        cold->tail->next = e;
+    else
+        cold->head = e;
+    cold->tail = e;
+    cold->count++;
+    pthread_cond_signal(&cold->cond);
+    pthread_mutex_unlock(&cold->lock);
+    return 1;
+}
+
+/*
+ * Return 1 if the first SFILE_CACHE_PROBE bytes of fi are in page
+ * cache (or on error, reported by the search), else start to read
+ * them in background (POSIX_FADV_WILLNEED). *fd is the file opened
+ * for the probe, kept for the search, or -1.
+ */
+static int
+file_cached(struct sfile_ctx_s *x, const struct finfo_s *fi, int *fd)
+{
+    int cached;
+    size_t len;
+
+    *fd = open_read_file(x, fi, 0);
+    if (*fd == -1)
+        return 1;
+    len = (size_t) fi->fi_stat.st_size;
+    if (len > SFILE_CACHE_PROBE)
+        len = SFILE_CACHE_PROBE;
+    cached = cache_probe(*fd, len);
+#ifdef POSIX_FADV_WILLNEED
+    if (!cached)
+        posix_fadvise(*fd, 0, (off_t) len, POSIX_FADV_WILLNEED);
+#endif /* POSIX_FADV_WILLNEED */
+    return cached;
+}
+
+/* 1 if the len first bytes of fd are in page cache */
+static int
+cache_probe(int fd, size_t len)
+{
+#ifdef MACOS
+    (void) fd;
+    (void) len;
+    return 1;
+#else
+    int cached;
+    size_t i;
+    size_t page;
+    size_t n_pages;
+    void *addr = NULL;
+    unsigned char *vec = NULL;
+# ifdef SFILE_SYS_CACHESTAT
+    struct cache_stat_s cs;
+    struct cache_range_s range;
+# endif /* SFILE_SYS_CACHESTAT */
+
+    page = (size_t) sysconf(_SC_PAGESIZE);
+    n_pages = (len + page - 1) / page;
+# ifdef SFILE_SYS_CACHESTAT
+    range.off = 0;
+    range.len = len;
+    if (!syscall(SFILE_SYS_CACHESTAT, fd, &range, &cs, 0))
+        return cs.nr_cache >= n_pages;
+# endif /* SFILE_SYS_CACHESTAT */
+
+    /* kernel without cachestat(): pages of a mapping */
+    addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return 1;
+    vec = xmalloc(n_pages);
+    cached = !mincore(addr, len, vec);
+    for (i = 0; cached && i < n_pages; i++)
+        cached = (vec[i] & 1);
+    xfree(vec);
+    munmap(addr, len);
+    return cached;
+#endif /* MACOS */
+}
+
+/*
+ * Start the cold readers, --slow-jobs threads (cold->lock locked).
+ * Return the number started, 0 and the files are searched inline.
+ */
+static int
+cold_start(struct sfile_ctx_s *x)
+{
+    int i;
+    int ret;
+    int n;
+    struct sfile_cold_s *cold = x->cold;
+
+    n = x->n_slow_jobs > 0 ? x->n_slow_jobs : SFILE_COLD_READERS;
+    cold->threads = xmalloc((size_t) n * sizeof(pthread_t));
+    for (i = 0; i < n; i++) {
+        ret = pthread_create(&cold->threads[cold->n_threads], NULL,
+                             cold_reader, cold);
+        if (ret) {
+            fprintf(stderr, "%s:pthread_create: %s\n", x->prog_name,
+                    strerror(ret));
+            break;
+        }
+        cold->n_threads++;
+    }
+    /* nobody to read the cold files */
+    if (!cold->n_threads) {
+        xfree(cold->threads);
+        cold->threads = NULL;
+        cold->no_reader = 1;
+    }
+    return cold->n_threads;
+}
+
+/* check the queued files, while the scan continues */
+static void *
+cold_reader(void *data)
+{
+    struct fbuf_s fb;
+    struct finfo_s fi;
+    struct sfile_cold_s *cold = data;
+    struct cold_entry_s *e = NULL;
+
+    for (;;) {
+        pthread_mutex_lock(&cold->lock);
+        while (!cold->head && !cold->closed)
+            pthread_cond_wait(&cold->cond, &cold->lock);
+        e = cold->head;
+        if (e) {
+            cold->head = e->next;
+            if (!cold->head)
+                cold->tail = NULL;
+            cold->count--;
+        }
+        pthread_mutex_unlock(&cold->lock);
+        if (!e)
+            break;
+        fbuf_init(&fb, e->fd);
+        if (!SFILE_STOPPED(cold->x)) {
+            fi.fi_path = e->path;
+            set_object_name(&fi);
+            fi.fi_root = e->root;
+            fi.fi_type = e->type;
+            fi.fi_stat = e->st;
+            filter_object_mode(cold->x, &fi, &fb);
+        }
+        fbuf_close(cold->x, &fb);
+        xfree(e->path);
+        xfree(e);
+    }
+    trace_thread_exit(cold->x);
+    summary_thread_exit();
+    return NULL;
+}
+
+/* wait the cold readers, the queue is empty after */
+static void
+cold_drain(struct sfile_ctx_s *x)
+{
+    int i;
+    struct sfile_cold_s *cold = x->cold;
+
+    pthread_mutex_lock(&cold->lock);
+    cold->closed = 1;
+    pthread_cond_broadcast(&cold->cond);
+    pthread_mutex_unlock(&cold->lock);
+    for (i = 0; i < cold->n_threads; i++)
+        pthread_join(cold->threads[i], NULL);
+    xfree(cold->threads);
+    cold->threads = NULL;
+    cold->n_threads = 0;
+    cold->closed = 0;
+}
+
+static void
+cold_free(struct sfile_ctx_s *x)
+{
+    if (!x->cold)
+        return;
+    cold_drain(x);
+    pthread_mutex_destroy(&x->cold->lock);
+    pthread_cond_destroy(&x->cold->cond);
+    xfree(x->cold);
+    x->cold = NULL;
+}
+
+/*
+ * --summary: add fi to the row of its directory, cut to
+ * x->summary_depth directories below the scanned path, in the
+ * accumulators of the calling thread.
+ */
+static void
+summary_add(struct sfile_ctx_s *x, const struct finfo_s *fi,
+            unsigned long n_match)
+{
+    int depth;
+    size_t len;
+    const char *p = NULL;
+    const char *next = NULL;
+    struct sfile_summary_s *row = NULL;
+    struct summary_thread_s *th = NULL;
+
+    for (th = summary_self; th && th->s != x->summary; th = th->next)
+        continue;
+    if (!th) {
+        th = xmalloc(sizeof(struct summary_thread_s));
+        memset(th, 0, sizeof(struct summary_thread_s));
+        th->s = x->summary;
+        th->next = summary_self;
+        summary_self = th;
+    }
+
+    len = fi->fi_root;
+    p = fi->fi_path + len;
+    for (depth = 0; depth < x->summary_depth; depth++) {
+        while (*p == '/')
+            p++;
+        next = strchr(p, '/');
+        /* fi_name is not a directory of the row */
+        if (!next || next > fi->fi_name)
+            break;
+        len = (size_t) (next - fi->fi_path);
+        p = next;
+    }
+    while (len > 1 && fi->fi_path[len - 1] == '/')
+        len--;
+
+    row = summary_row(&th->table, fi->fi_path, len);
+    row->n_entries++;
+    row->n_type[fi->fi_type]++;
+    row->size += (unsigned long long) fi->fi_stat.st_size;
+    row->blocks += (unsigned long long) fi->fi_stat.st_blocks * 512;
+    row->n_match += n_match;
+}
+
+/* row of dir (len characters) in t, added if not found */
+static struct sfile_summary_s *
+summary_row(struct summary_table_s *t, const char *dir, size_t len)
+{
+    size_t i;
+    size_t old_size;
+    struct sfile_summary_s *row = NULL;
+    struct sfile_summary_s *old = NULL;
+
+    if (t->count * 2 >= t->size) {
+        old = t->rows;
+        old_size = t->size;
+        t->size = t->size ? t->size * 2 : 64;
+        t->rows = xmalloc(t->size * sizeof(struct sfile_summary_s));
+        memset(t->rows, 0, t->size * sizeof(struct sfile_summary_s));
+        for (i = 0; i < old_size; i++) {
+            if (old[i].dir)
+                *summary_slot(t, old[i].dir, strlen(old[i].dir)) = old[i];
+        }
+        xfree(old);
+    }
+    row = summary_slot(t, dir, len);
+    if (!row->dir) {
+        row->dir = xmalloc(len + 1);
+        memcpy(row->dir, dir, len);
+        row->dir[len] = '\0';
+        t->count++;
+    }
+    return row;
+}
+
+/* row of dir in t, or the free row where to add it */
+static struct sfile_summary_s *
+summary_slot(struct summary_table_s *t, const char *dir, size_t len)
+{
+    size_t i;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char) dir[i];
+        hash *= 0x100000001b3ULL;
+    }
+    for (i = (size_t) hash & (t->size - 1); t->rows[i].dir;
+         i = (i + 1) & (t->size - 1)) {
+        if (!strncmp(t->rows[i].dir, dir, len) && !t->rows[i].dir[len])
+            break;
+    }
+    return &t->rows[i];
+}
+
+/* add the rows of from to to, from is emptied */
+static void
+summary_merge(struct summary_table_s *to, struct summary_table_s *from)
+{
+    int k;
+    size_t i;
+    struct sfile_summary_s *row = NULL;
+    struct sfile_summary_s *add = NULL;
+
+    for (i = 0; i < from->size; i++) {
+        add = &from->rows[i];
+        if (!add->dir)
+            continue;
+        row = summary_row(to, add->dir, strlen(add->dir));
+        row->n_entries += add->n_entries;
+        for (k = 0; k <= TF_ERROR; k++)
+            row->n_type[k] += add->n_type[k];
+        row->size += add->size;
+        row->blocks += add->blocks;
+        row->n_match += add->n_match;
+        xfree(add->dir);
+    }
+    xfree(from->rows);
+    from->rows = NULL;
+    from->count = 0;
+    from->size = 0;
+}
+
+/*
+ * Merge the accumulators of the calling thread in the totals,
+ * at the end of a worker and in sfile_finish().
+ */
+static void
+summary_thread_exit(void)
+{
+    struct summary_thread_s *th = NULL;
+
+    while ((th = summary_self)) {
+        summary_self = th->next;
+        pthread_mutex_lock(&th->s->lock);
+        summary_merge(&th->s->total, &th->table);
+        pthread_mutex_unlock(&th->s->lock);
+        xfree(th);
+    }
+}
+
+static void
+summary_free(struct sfile_ctx_s *x)
+{
+    size_t i;
+    struct sfile_sums_s *s = x->summary;
+    struct summary_thread_s **th = NULL;
+    struct summary_thread_s *empty = NULL;
+
+    if (!s)
+        return;
+    /* accumulators of this thread not merged (no sfile_finish()) */
+    for (th = &summary_self; *th;) {
+        if ((*th)->s == s) {
+            empty = *th;
+            *th = empty->next;
+            summary_merge(&s->total, &empty->table);
+            xfree(empty);
+        }
+        else
+            th = &(*th)->next;
+    }
+    for (i = 0; i < s->total.size; i++)
+        xfree(s->total.rows[i].dir);
+    xfree(s->total.rows);
+    pthread_mutex_destroy(&s->lock);
+    xfree(s);
+    x->summary = NULL;
+}
+
+static int
+cmp_summary(const void *a, const void *b)
+{
+    return strcmp(((const struct sfile_summary_s *) a)->dir,
+                  ((const struct sfile_summary_s *) b)->dir);
+}
+
+/*
+ * --estimate: probes of the tree of path, until x->estimate_time
+ * seconds or x->estimate_fraction of its entries are checked. The
+ * mean of the probes estimates the totals of the tree, their variance
+ * gives the interval.
+ */
+static void
+sample_dir_object(struct sfile_ctx_s *x, const char *path)
+{
+    int k;
+    unsigned long n;
+    unsigned long checked;
+    double start;
+    double delta;
+    struct sfile_sample_s *s = x->sample;
+
+    start = clock_seconds(CLOCK_MONOTONIC);
+    checked = s->n_checked;
+    memset(s->mean, 0, sizeof(s->mean));
+    memset(s->m2, 0, sizeof(s->m2));
+    for (n = 0; !SFILE_STOPPED(x);) {
+        memset(s->probe, 0, sizeof(s->probe));
+        s->acc = s->probe;
+        k = sample_probe(x, path);
+        s->acc = s->total;
+        s->weight = 1;
+        if (k)
+            break;
+        n++;
+        for (k = 0; k < SV_COUNT; k++) {
+            delta = s->probe[k] - s->mean[k];
+            s->mean[k] += delta / (double) n;
+            s->m2[k] += delta * (s->probe[k] - s->mean[k]);
+        }
+        if (x->estimate_time > 0 ?
+            (n >= 2 &&
+             clock_seconds(CLOCK_MONOTONIC) - start >= x->estimate_time) :
+            (n >= SFILE_SAMPLE_MIN_PROBES &&
+             (double) (s->n_checked - checked) >=
+             x->estimate_fraction * s->mean[SV_ENTRIES]))
+            break;
+    }
+    s->n_probes += n;
+    for (k = 0; k < SV_COUNT; k++) {
+        s->total[k] += s->mean[k];
+        if (n > 1)
+            s->var[k] += s->m2[k] / (double) (n - 1) / (double) n;
+    }
+}
+
+/* one random descent from path, -1 if path is not read */
+static int
+sample_probe(struct sfile_ctx_s *x, const char *path)
+{
+    int ret;
+    int depth;
+    double weight;
+    char *dir = NULL;
+    char *next = NULL;
+    struct stat st;
+    struct walk_s w;
+    struct ancestor_s *parent = NULL;
+
+    walk_init(x, &w);
+    w.root_len = strlen(path);
+    if (!stat(path, &st))
+        w.root_dev = st.st_dev;
+    ret = 0;
+    weight = 1;
+    dir = xstrdup(path);
+    for (depth = 0; dir; depth++) {
+        /* --follow: the probe is one chain of directories */
+        if ((x->opts & O_FOLLOW_LINK) && !stat(dir, &st)) {
+            parent = w.anc;
+            w.anc = ancestor_new(x, parent, NULL, &st);
+            ancestor_release(parent, NULL);
+        }
+        if (sample_dir(x, &w, dir, &weight, &next) && !depth)
+            ret = -1;
+        xfree(dir);
+        dir = SFILE_STOPPED(x) ? NULL : next;
+        if (!dir)
+            xfree(next);
+    }
+    ancestor_release(w.anc, NULL);
+    walk_free(&w);
+    return ret;
+}
+
+/*
+ * Check SFILE_SAMPLE_ENTRIES entries of path, chosen by reservoir
+ * sampling, each one with the weight of n / SFILE_SAMPLE_ENTRIES
+ * entries, and choose the next directory of the probe (*next, to free)
+ * among the subdirectories. *weight is the inverse of the probability
+ * to reach path, then of the next directory.
+ */
+static int
+sample_dir(struct sfile_ctx_s *x, struct walk_s *w, const char *path,
+           double *weight, char **next)
+{
+    int dfd;
+    size_t i;
+    size_t k;
+    size_t len;
+    uint64_t r;
+    unsigned long n;
+    unsigned long n_dirs;
+    DIR *dir = NULL;
+    struct dirent *ent = NULL;
+    struct finfo_s fi;
+    struct sfile_sample_s *s = x->sample;
+
+    *next = NULL;
+    throttle_io(x, 1, 0);
+    dir = open_dir(x, path);
+    if (!dir)
+        return -1;
+    s->n_dirs++;
+    walk_set_dir(w, path);
+    dfd = dirfd(dir);
+    n = 0;
+    n_dirs = 0;
+    while ((ent = readdir(dir))) {
+        if (!keep_dir_entry(x, ent->d_name))
+            continue;
+        /* entry n replaces one of the reservoir with probability k / n */
+        r = (n < SFILE_SAMPLE_ENTRIES) ? n : sample_rand(s) % (n + 1);
+        n++;
+        if (r < SFILE_SAMPLE_ENTRIES) {
+            xfree(s->names[r]);
+            s->names[r] = xstrdup(ent->d_name);
+        }
+        if (!(x->opts & O_RECURSIVE) || !sample_is_dir(x, w, dfd, ent) ||
+            sample_rand(s) % ++n_dirs)
+            continue;
+        xfree(*next);
+        len = strlen(ent->d_name);
+        *next = xmalloc(w->path_len + len + 1);
+        memcpy(*next, w->path, w->path_len);
+        memcpy(*next + w->path_len, ent->d_name, len + 1);
+    }
+
+    k = (n < SFILE_SAMPLE_ENTRIES) ? n : SFILE_SAMPLE_ENTRIES;
+    if (k)
+        s->weight = *weight * (double) n / (double) k;
+    for (i = 0; i < k && !SFILE_STOPPED(x); i++) {
+        len = strlen(s->names[i]);
+        walk_path_reserve(w, w->path_len + len);
+        memcpy(w->path + w->path_len, s->names[i], len + 1);
+        fi.fi_path = w->path;
+        fi.fi_name = w->path + w->path_len;
+        fi.fi_root = w->root_len;
+        fi.fi_dfd = dfd;
+        sample_check(x, &fi);
+    }
+    closedir(dir);
+    *weight *= (double) n_dirs;
+    return 0;
+}
+
+/* ent is a directory where the scan descends */
+static int
+sample_is_dir(struct sfile_ctx_s *x, struct walk_s *w, int dfd,
+              const struct dirent *ent)
+{
+    size_t len;
+    struct finfo_s fi;
+
+#ifdef DT_DIR
+    /* no stat() if the type is enough */
+    if (ent->d_type == DT_DIR && !x->skip_fstype &&
+        !(x->opts & (O_ONE_FS | O_FOLLOW_LINK)))
+        return 1;
+    if (ent->d_type != DT_UNKNOWN && ent->d_type != DT_DIR &&
+        (ent->d_type != DT_LNK || !(x->opts & O_FOLLOW_LINK)))
+        return 0;
+#endif /* DT_DIR */
+    len = strlen(ent->d_name);
+    walk_path_reserve(w, w->path_len + len);
+    memcpy(w->path + w->path_len, ent->d_name, len + 1);
+    fi.fi_path = w->path;
+    fi.fi_name = w->path + w->path_len;
+    fi.fi_root = w->root_len;
+    fi.fi_dfd = dfd;
+    fi.fi_type = get_file_type(x, &fi);
+    return fi.fi_type == TF_DIR && descend_dir(x, w, &fi);
+}
+
+/* check fi with the weight of the entries it stands for */
+static void
+sample_check(struct sfile_ctx_s *x, struct finfo_s *fi)
+{
+    struct sfile_sample_s *s = x->sample;
+
+    s->n_checked++;
+    s->acc[SV_ENTRIES] += s->weight;
+    check_object(x, fi);
+    if (fi->fi_type != TF_ERROR && S_ISREG(fi->fi_stat.st_mode))
+        s->acc[SV_BYTES] += s->weight * (double) fi->fi_stat.st_size;
+}
+
+/* result of the entry checked by sample_check() */
+static void
+sample_add(struct sfile_ctx_s *x, unsigned long n_match)
+{
+    struct sfile_sample_s *s = x->sample;
+
+    s->acc[SV_RESULTS] += s->weight;
+    s->acc[SV_MATCHES] += s->weight * (double) n_match;
+}
+
+/* xorshift64* */
+static uint64_t
+sample_rand(struct sfile_sample_s *s)
+{
+    s->rand ^= s->rand >> 12;
+    s->rand ^= s->rand << 25;
+    s->rand ^= s->rand >> 27;
+    return s->rand * 0x2545f4914f6cdd1dULL;
+}
+
+/* totals of the scanned paths, intervals by normal approximation */
+static void
+sample_result(struct sfile_ctx_s *x, struct sfile_estimate_s *est)
+{
+    int k;
+    double half;
+    struct sfile_interval_s *v[SV_COUNT];
+    struct sfile_sample_s *s = x->sample;
+
+    est->n_probes = s->n_probes;
+    est->n_dirs = s->n_dirs;
+    est->n_checked = s->n_checked;
+    est->seconds = clock_seconds(CLOCK_MONOTONIC) - s->start;
+    v[SV_ENTRIES] = &est->entries;
+    v[SV_BYTES] = &est->bytes;
+    v[SV_RESULTS] = &est->results;
+    v[SV_MATCHES] = &est->matches;
+    for (k = 0; k < SV_COUNT; k++) {
+        half = 1.96 * sqrt(s->var[k]);
+        v[k]->value = s->total[k];
+        v[k]->low = (s->total[k] > half) ? s->total[k] - half : 0;
+        v[k]->high = s->total[k] + half;
+    }
+}
+
+static void
+sample_free(struct sfile_ctx_s *x)
+{
+    int i;
+
+    if (!x->sample)
+        return;
+    for (i = 0; i < SFILE_SAMPLE_ENTRIES; i++)
+        xfree(x->sample->names[i]);
+    xfree(x->sample);
+    x->sample = NULL;
+}
+
+static struct sfile_fold_s *
+fold_new(const char *str)
+{
+    struct sfile_fold_s *f = NULL;
+
+    f = xmalloc(sizeof(struct sfile_fold_s));
+    fold_init(f, str, strlen(str));
+    return f;
+}
+
+/* fold the code points of str, and list the first bytes of a match */
+static void
+fold_init(struct sfile_fold_s *f, const char *str, size_t len)
+{
+    size_t i;
+    uint32_t lo;
+    const char *end = str + len;
+
+    f->cp = xmalloc((len + 1) * sizeof(uint32_t));
+    for (f->n_cp = 0; str < end; f->n_cp++) {
+        str = utf8_decode(str, end, &f->cp[f->n_cp]);
+        f->cp[f->n_cp] = fold_cp(f->cp[f->n_cp]);
+    }
+    f->max_len = 4 * f->n_cp;
+    memset(f->lead, 0, sizeof(f->lead));
+    if (!f->n_cp)
+        return;
+
+    /* code points folded to the first one */
+    fold_set_lead(f, f->cp[0]);
+    if (f->cp[0] >= 'a' && f->cp[0] <= 'z')
+        fold_set_lead(f, f->cp[0] - 'a' + 'A');
+    for (i = 0; i < sizeof(fold_ranges) / sizeof(fold_ranges[0]); i++) {
+        lo = (uint32_t) ((int32_t) f->cp[0] - fold_ranges[i].delta);
+        if (lo >= fold_ranges[i].lo && lo <= fold_ranges[i].hi &&
+            !((lo - fold_ranges[i].lo) % fold_ranges[i].stride))
+            fold_set_lead(f, lo);
+    }
+
+    /* the block scan looks for two ASCII bytes, else a first byte */
+    f->ascii[0] = 0;
+    f->ascii[1] = 0;
+    for (i = 0; i < 256; i++) {
+        if (f->lead[i] && (i < 0x80 || !f->ascii[0])) {
+            f->ascii[1] = f->ascii[0];
+            f->ascii[0] = (unsigned char) i;
+        }
+    }
+    if (!f->ascii[1])
+        f->ascii[1] = f->ascii[0];
+}
+
+static void
+fold_free(struct sfile_fold_s *f)
+{
+    if (!f)
+        return;
+    xfree(f->cp);
+    xfree(f);
+}
+
+/* first byte of cp in UTF-8 */
+static void
+fold_set_lead(struct sfile_fold_s *f, uint32_t cp)
+{
+    if (cp < 0x80)
+        f->lead[cp] = 1;
+    else if (cp < 0x800)
+        f->lead[0xc0 | (cp >> 6)] = 1;
+    else if (cp < 0x10000)
+        f->lead[0xe0 | (cp >> 12)] = 1;
+    else if (cp < 0x110000)
+        f->lead[0xf0 | (cp >> 18)] = 1;
+    else
+        f->lead[cp - 0x110000] = 1;
+}
+
+/* simple case folding, by a binary search of fold_ranges */
+static uint32_t
+fold_cp(uint32_t cp)
+{
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    if (cp < 0x80)
+        return (cp >= 'A' && cp <= 'Z') ? cp + ('a' - 'A') : cp;
+    lo = 0;
+    hi = sizeof(fold_ranges) / sizeof(fold_ranges[0]);
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cp < fold_ranges[mid].lo)
+            hi = mid;
+        else if (cp > fold_ranges[mid].hi)
+            lo = mid + 1;
+        else if ((cp - fold_ranges[mid].lo) % fold_ranges[mid].stride)
+            return cp;
+        else
+            return (uint32_t) ((int32_t) cp + fold_ranges[mid].delta);
+    }
+    return cp;
+}
+
+/*
+ * Decode the character at p: a byte not in a valid sequence
+ * (overlong, surrogate, cut) is one FOLD_INVALID() code point.
+ */
+static const char *
+utf8_decode(const char *p, const char *end, uint32_t *cp)
+{
+    /* length of a sequence by its first byte, 0: invalid */
+    static const unsigned char utf8_len[256] = {
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+        2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+        3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+        4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+    /* smallest code point by length, for overlong sequences */
+    static const uint32_t utf8_min[5] = {0, 0, 0x80, 0x800, 0x10000};
+    int i;
+    int n;
+    uint32_t c;
+    const unsigned char *s = (const unsigned char *) p;
+
+    n = utf8_len[*s];
+    if (n == 1) {
+        *cp = *s;
+        return p + 1;
+    }
+    if (!n || end - p < n)
+        goto invalid;
+    c = *s & (0x7fU >> n);
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            goto invalid;
+        c = (c << 6) | (s[i] & 0x3fU);
+    }
+    if (c < utf8_min[n] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+        goto invalid;
+    *cp = c;
+    return p + n;
+
+invalid:
+    *cp = FOLD_INVALID(*s);
+    return p + 1;
+}
+
+/*
+ * End of the match of f at p, or NULL. ASCII bytes are folded by
+ * a test, other characters are decoded and folded by the table.
+ */
+static const char *
+fold_match(const struct sfile_fold_s *f, const char *p, const char *end)
+{
+    size_t i;
+    uint32_t cp;
+    unsigned char c;
+
+    for (i = 0; i < f->n_cp; i++) {
+        if (p == end)
+            return NULL;
+        c = (unsigned char) *p;
+        if (c < 0x80) {
+            cp = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+            p++;
+        }
+        else {
+            p = utf8_decode(p, end, &cp);
+            cp = fold_cp(cp);
+        }
+        if (cp != f->cp[i])
+            return NULL;
+    }
+    return p;
+}
+
+/*
+ * First byte from p that can begin a match, or end. Blocks of 16
+ * (SSE2) or 8 bytes without the ASCII first bytes and without
+ * non-ASCII byte are skipped; the non-ASCII bytes are checked
+ * with f->lead.
+ */
+static const char *
+fold_next(const struct sfile_fold_s *f, const char *p, const char *end)
+{
+#ifdef __SSE2__
+    unsigned bits;
+    unsigned high;
+    __m128i block;
+    const __m128i a0 = _mm_set1_epi8((char) f->ascii[0]);
+    const __m128i a1 = _mm_set1_epi8((char) f->ascii[1]);
+
+    while (end - p >= 16) {
+        block = _mm_loadu_si128((const __m128i *) (const void *) p);
+        bits = (unsigned) _mm_movemask_epi8(_mm_or_si128(
+                   _mm_cmpeq_epi8(block, a0), _mm_cmpeq_epi8(block, a1)));
+        high = (unsigned) _mm_movemask_epi8(block) & ~bits;
+        for (; high; high &= high - 1) {
+            if (f->lead[(unsigned char) p[__builtin_ctz(high)]])
+                bits |= high & -high;
+        }
+        if (bits)
+            return p + __builtin_ctz(bits);
+        p += 16;
+    }
+#else
+# define SWAR_ONES 0x0101010101010101ULL
+# define SWAR_HIGH 0x8080808080808080ULL
+# define SWAR_ZERO(v) (((v) - SWAR_ONES) & ~(v) & SWAR_HIGH)
+    int i;
+    uint64_t w;
+    const uint64_t a0 = SWAR_ONES * f->ascii[0];
+    const uint64_t a1 = SWAR_ONES * f->ascii[1];
+
+    while (end - p >= 8) {
+        memcpy(&w, p, sizeof(w));
+        if (SWAR_ZERO(w ^ a0) || SWAR_ZERO(w ^ a1) || (w & SWAR_HIGH)) {
+            for (i = 0; i < 8; i++) {
+                if (f->lead[(unsigned char) p[i]])
+                    return p + i;
+            }
+        }
+        p += 8;
+    }
+#endif /* __SSE2__ */
+    for (; p < end; p++) {
+        if (f->lead[(unsigned char) *p])
+            return p;
+    }
+    return end;
+}
+
+/*
+ * First match of f in mem, or NULL. A folded match can have an other
+ * length than the needle, it is set in *match_len if not NULL.
+ */
+static const char *
+fold_find(const struct sfile_fold_s *f, const char *mem, size_t len,
+          size_t *match_len)
+{
+    const char *p = NULL;
+    const char *end = mem + len;
+
+    if (!f->n_cp)
+        return NULL;
+    for (; (mem = fold_next(f, mem, end)) < end; mem++) {
+        if ((p = fold_match(f, mem, end))) {
+            if (match_len)
+                *match_len = (size_t) (p - mem);
+            return mem;
+        }
+    }
+    return NULL;
+}
+
+/* name is the needle of f, without case distinction */
+static int
+fold_equal(const struct sfile_fold_s *f, const char *name)
+{
+    const char *end = name + strlen(name);
+
+    return fold_match(f, name, end) == end;
+}
+
+/*
+ * Give the results kept until the end of the scan (--fuzzy-name),
+ * best first. Call it after the last sfile_scan_*().
+ */
+void
+sfile_finish(struct sfile_ctx_s *x)
+{
+    size_t i;
+    size_t n;
+    struct sfile_result_s res;
+    struct sfile_estimate_s est;
+    struct summary_table_s *t = NULL;
+    struct sfile_summary_s *rows = NULL;
+    struct sfile_fuzzy_s *f = x->fuzzy_top;
+
+    /* results of the files not in page cache */
+    if (x->cold)
+        cold_drain(x);
+    for (i = 0; i < x->n_queries; i++)
+        sfile_finish(x->queries[i]);
+    if (x->sample) {
+        sample_result(x, &est);
+        if (x->estimate_cb)
+            x->estimate_cb(&est, x->estimate_data);
+        sample_free(x);
+    }
+    if (x->summary) {
+        /* totals of this thread, the workers are merged */
+        summary_thread_exit();
+        t = &x->summary->total;
+        rows = xmalloc((t->count + 1) * sizeof(struct sfile_summary_s));
+        for (i = 0, n = 0; i < t->size; i++) {
+            if (t->rows[i].dir)
+                rows[n++] = t->rows[i];
+        }
+        qsort(rows, n, sizeof(struct sfile_summary_s), cmp_summary);
+        for (i = 0; i < n && x->summary_cb; i++) {
+            if (x->summary_cb(&rows[i], x->summary_data))
+                break;
+        }
+        xfree(rows);
+        summary_free(x);
+    }
+    if (!f)
+        return;
+    qsort(f->heap, f->count, sizeof(struct fuzzy_entry_s), fuzzy_cmp_qsort);
+    memset(&res, 0, sizeof(struct sfile_result_s));
+    for (i = 0; i < f->count && x->n_exit; i++) {
+        res.path = f->heap[i].path;
+        res.name = strrchr(res.path, '/');
+        res.name = res.name ? res.name + 1 : res.path;
+        res.type = f->heap[i].type;
+        res.st = &f->heap[i].st;
+        if (x->result_cb && x->result_cb(&res, x->result_data))
+            x->n_exit = 0;
+        else
+            x->n_exit--;
+    }
+    fuzzy_free(x);
+}
+
+/* bitap masks of x->fuzzy, bit i for character i of the pattern */
+static void
+fuzzy_init(struct sfile_ctx_s *x)
+{
+    size_t i;
+    unsigned char ch;
+    struct sfile_fuzzy_s *f = NULL;
+
+    fuzzy_free(x);
+    f = xmalloc(sizeof(struct sfile_fuzzy_s));
+    memset(f, 0, sizeof(struct sfile_fuzzy_s));
+    f->len = strlen(x->fuzzy);
+    if (f->len > 64)
+        f->len = 64;
+    for (i = 0; i < f->len; i++) {
+        ch = (unsigned char) x->fuzzy[i];
+        if ((x->opts & O_IGN_CASE_FILE_NAME)) {
+            f->mask[tolower(ch)] |= (uint64_t) 1 << i;
+            f->mask[toupper(ch)] |= (uint64_t) 1 << i;
+        }
+        else
+            f->mask[ch] |= (uint64_t) 1 << i;
+    }
+    if (x->fuzzy_dist < 0)
+        x->fuzzy_dist = 0;
+    if (x->fuzzy_dist > SFILE_FUZZY_MAX_DIST)
+        x->fuzzy_dist = SFILE_FUZZY_MAX_DIST;
+    f->size = x->fuzzy_top_n > 0 ? (size_t) x->fuzzy_top_n : 1;
+    f->heap = xmalloc(f->size * sizeof(struct fuzzy_entry_s));
+    x->fuzzy_top = f;
+}
+
+static void
+fuzzy_free(struct sfile_ctx_s *x)
+{
+    size_t i;
+    struct sfile_fuzzy_s *f = x->fuzzy_top;
+
+    if (!f)
+        return;
+    for (i = 0; i < f->count; i++)
+        xfree(f->heap[i].path);
+    xfree(f->heap);
+    xfree(f);
+    x->fuzzy_top = NULL;
+}
+
+/* keep fi if it is in the best x->fuzzy_top_n results, return 0 */
+static int
+fuzzy_add(struct sfile_ctx_s *x, const struct finfo_s *fi)
+{
+    const char *p = NULL;
+    struct fuzzy_entry_s e;
+    struct sfile_fuzzy_s *f = x->fuzzy_top;
+
+    e.dist = fuzzy_distance(f, fi->fi_name, x->fuzzy_dist);
+    if (e.dist < 0)
+        return 0;
+    e.depth = 0;
+    for (p = fi->fi_path; *p; p++) {
+        if (*p == '/')
+            e.depth++;
+    }
+    e.path = fi->fi_path;
+
+    pthread_mutex_lock(&x->lock);
+    if (f->count == f->size && fuzzy_cmp(&e, &f->heap[0]) >= 0) {
+        pthread_mutex_unlock(&x->lock);
+        return 0;
+    }
+    e.path = xstrdup(fi->fi_path);
+    e.type = fi->fi_type;
+    e.st = fi->fi_stat;
+    if (f->count == f->size) {
+        /* replace the worst result */
+        xfree(f->heap[0].path);
+        f->heap[0] = e;
+        fuzzy_sift_down(f, 0);
+    }
+    else {
+        size_t i = f->count++;
+
+        /* sift up */
+        while (i && fuzzy_cmp(&e, &f->heap[(i - 1) / 2]) > 0) {
+            f->heap[i] = f->heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        f->heap[i] = e;
+    }
+    pthread_mutex_unlock(&x->lock);
+    return 0;
+}
+
+/*
+ * Smallest edit distance between the pattern and a substring of name,
+ * or -1 if it is more than max. Bit-parallel (Wu-Manber bitap):
+ * bit i of r[d] is set if the pattern[0..i] matches with d errors
+ * before the current character.
+ */
+static int
+fuzzy_distance(const struct sfile_fuzzy_s *f, const char *name, int max)
+{
+    int d;
+    int best;
+    uint64_t old;
+    uint64_t prev;
+    uint64_t found;
+    uint64_t r[SFILE_FUZZY_MAX_DIST + 1];
+
+    if (!f->len)
+        return 0;
+    memset(r, 0, sizeof(r));
+    found = (uint64_t) 1 << (f->len - 1);
+    /* d first characters of the pattern deleted */
+    for (d = 0; d <= max; d++)
+        r[d] = ((uint64_t) 1 << d) - 1;
+    best = (r[max] & found) ? max : -1;
+    for (; *name; name++) {
+        old = r[0];
+        r[0] = ((r[0] << 1) | 1) & f->mask[(unsigned char) *name];
+        for (d = 1; d <= max; d++) {
+            prev = r[d];
+            /* match, insertion, substitution and deletion */
+            r[d] = (((r[d] << 1) | 1) & f->mask[(unsigned char) *name]) |
+                old | (((old | r[d - 1]) << 1) | 1);
+            old = prev;
+        }
+        for (d = 0; d <= max && (best < 0 || d < best); d++) {
+            if ((r[d] & found)) {
+                best = d;
+                break;
+            }
+        }
+        if (!best)
+            break;
+    }
+    return best;
+}
+
+/* order of the results: distance, depth, then path */
+static int
+fuzzy_cmp(const struct fuzzy_entry_s *a, const struct fuzzy_entry_s *b)
+{
+    if (a->dist != b->dist)
+        return a->dist - b->dist;
+    if (a->depth != b->depth)
+        return a->depth - b->depth;
+    return strcmp(a->path, b->path);
+}
+
+static int
+fuzzy_cmp_qsort(const void *a, const void *b)
+{
+    return fuzzy_cmp(a, b);
+}
+
+/* heap of the worst result first */
+static void
+fuzzy_sift_down(struct sfile_fuzzy_s *f, size_t i)
+{
+    size_t child;
+    struct fuzzy_entry_s e = f->heap[i];
+
+    while ((child = 2 * i + 1) < f->count) {
+        if (child + 1 < f->count &&
+            fuzzy_cmp(&f->heap[child + 1], &f->heap[child]) > 0)
+            child++;
+        if (fuzzy_cmp(&f->heap[child], &e) <= 0)
+            break;
+        f->heap[i] = f->heap[child];
+        i = child;
+    }
+    f->heap[i] = e;
+}
+
+static void
+throttle_init(struct sfile_ctx_s *x)
+{
+    double now;
+    struct sfile_throttle_s *t = &x->throttle;
+
+    t->enabled = (x->max_read_rate > 0 || x->max_iops > 0 ||
+                  x->max_cpu > 0);
+    if (!t->enabled)
+        return;
+    now = clock_seconds(CLOCK_MONOTONIC);
+    t->bytes.rate = x->max_read_rate * 1024 * 1024;
+    t->bytes.tokens = t->bytes.rate;
+    t->bytes.last = now;
+    t->ops.rate = x->max_iops;
+    t->ops.tokens = t->ops.rate;
+    t->ops.last = now;
+    t->wall_start = now;
+    t->cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/*
+ * Take tokens for ops I/O operations and bytes read, and sleep
+ * if the buckets are empty or if the process use more CPU than
+ * x->max_cpu.
+ */
+static void
+throttle_io(struct sfile_ctx_s *x, double ops, double bytes)
+{
+    double now;
+    double cpu;
+    double wait;
+    double cpu_wait;
+    struct timespec ts;
+    struct sfile_throttle_s *t = &x->throttle;
+
+    if (!t->enabled)
+        return;
+    wait = 0;
+    pthread_mutex_lock(&t->lock);
+    now = clock_seconds(CLOCK_MONOTONIC);
+    if (t->bytes.rate > 0 && bytes > 0)
+        wait = bucket_take(&t->bytes, now, bytes);
+    if (t->ops.rate > 0 && ops > 0) {
+        cpu_wait = bucket_take(&t->ops, now, ops);
+        if (cpu_wait > wait)
+            wait = cpu_wait;
+    }
+    if (x->max_cpu > 0) {
+        /* wall time needed for the CPU time used */
+        cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - t->cpu_start;
+        cpu_wait = cpu * 100 / x->max_cpu - (now - t->wall_start);
+        if (cpu_wait > wait)
+            wait = cpu_wait;
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    if (wait > 0) {
+        ts.tv_sec = (time_t) wait;
+        ts.tv_nsec = (long) ((wait - (double) ts.tv_sec) * 1e9);
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+            continue;
+    }
+}
+
+/* return seconds to wait for n tokens */
+static double
+bucket_take(struct sfile_bucket_s *b, double now, double n)
+{
+    b->tokens += (now - b->last) * b->rate;
+    if (b->tokens > b->rate)
+        b->tokens = b->rate;
+    b->last = now;
+    b->tokens -= n;
+    return (b->tokens < 0) ? -b->tokens / b->rate : 0;
+}
+
+static double
+clock_seconds(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void
+push_dir_stack(struct stack_s *stack, const char *path,
+               struct ancestor_s *anc, int fifo)
+{
+    struct walk_dir_s *d = NULL;
+    struct stack_chunk_s *new = NULL;
+
+    d = xmalloc(sizeof(struct walk_dir_s));
+    d->path = xstrdup(path);
+    d->anc = anc;
+    new = xmalloc(sizeof(struct stack_chunk_s));
+    new->un.data = d;
+    /* breadth first for --first-fast */
+    if (fifo) {
+        APPENDTOSTACK(stack, new);
+        return;
+    }
+    if (stack->chunk) {
+        new->next = stack->chunk->next;
+        stack->chunk->next = new;
+    }
+    else {
+        stack->chunk = new;
+        new->next = NULL;
+    }
+}
+
+/* line is NULL or points in the file buffer, it is not copied */
+static void
+push_line_stack(struct stack_s *stack, const char *line, size_t len, long n,
+                long off, size_t col, size_t match_len, int context)
+{
+    struct stack_chunk_s *new = NULL;
+
+    new = xmalloc(sizeof(struct stack_chunk_s));
+    APPENDTOSTACK(stack, new);
+    new->un.data = xmalloc(sizeof(struct line_s));
+    LINE_S(new) = line;
+    LINE_LEN(new) = len;
+    LINE_N(new) = n;
+    LINE_OFF(new) = off;
+    LINE_COL(new) = col;
+    LINE_MLEN(new) = match_len;
+    LINE_CTX(new) = context;
+}
+
+static void
+free_line_stack(struct stack_chunk_s *chunk)
+{
+    struct stack_chunk_s *p_next = NULL;
+
+    while (chunk) {
+        p_next = chunk->next;
+        xfree(chunk->un.data);
+        xfree(chunk);
+        chunk = p_next;
+    }
+}
+
+/*
+ * --trace: open path and write the Chrome trace header. Events are
+ * written in buffers of their thread, and full buffers are written
+ * by a flusher thread.
+ */
+int
+sfile_trace_open(struct sfile_ctx_s *x, const char *path)
+{
+    int ret;
+    char buf[128];
+    struct sfile_trace_s *t = NULL;
+
+    t = xmalloc(sizeof(struct sfile_trace_s));
+    memset(t, 0, sizeof(struct sfile_trace_s));
+    t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (t->fd == -1) {
+        xfree(t);
+        return -1;
+    }
+    t->pid = (long) getpid();
+    t->t0 = clock_seconds(CLOCK_MONOTONIC);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_mutex_init(&t->write_lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    /* first event: all others begin by a comma */
+    snprintf(buf, sizeof(buf), "[{\"name\":\"process_name\",\"ph\":\"M\","
+             "\"pid\":%ld,\"args\":{\"name\":\"sfile\"}}", t->pid);
+    trace_write(t, buf, strlen(buf));
+    ret = pthread_create(&t->flusher, NULL, trace_flusher, t);
+    if (ret) {
+        fprintf(stderr, "%s:pthread_create: %s\n", x->prog_name,
+                strerror(ret));
+        close(t->fd);
+        xfree(t);
+        return -1;
+    }
+    x->trace = t;
+    return 0;
+}
+
+/* write the last events, called when the scan is finished */
+void
+sfile_trace_close(struct sfile_ctx_s *x)
+{
+    struct sfile_trace_s *t = x->trace;
+
+    if (!t)
+        return;
+    trace_thread_exit(x);
+    pthread_mutex_lock(&t->lock);
+    t->closed = 1;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->flusher, NULL);
+    trace_write(t, "\n]\n", 3);
+    close(t->fd);
+    pthread_mutex_destroy(&t->lock);
+    pthread_mutex_destroy(&t->write_lock);
+    pthread_cond_destroy(&t->cond);
+    xfree(t);
+    x->trace = NULL;
+}
+
+static double
+trace_begin(struct sfile_ctx_s *x)
+{
+    return x->trace ? clock_seconds(CLOCK_MONOTONIC) : 0;
+}
+
+/* complete event (ph X) of name, from start to now */
+static void
+trace_end(struct sfile_ctx_s *x, const char *name, const char *arg,
+          double start)
+{
+    double now;
+    char buf[192];
+    struct trace_thread_s *th = NULL;
+
+    if (!x->trace)
+        return;
+    now = clock_seconds(CLOCK_MONOTONIC);
+    th = trace_thread(x);
+    th->ev_len = 0;
+    snprintf(buf, sizeof(buf), ",\n{\"name\":\"%s\",\"ph\":\"X\","
+             "\"pid\":%ld,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+             name, x->trace->pid, th->tid,
+             (start - x->trace->t0) * 1e6, (now - start) * 1e6);
+    trace_put(th, buf, strlen(buf));
+    if (arg) {
+        trace_put(th, ",\"args\":{\"path\":", 16);
+        trace_put_json(th, arg);
+        trace_put(th, "}", 1);
+    }
+    trace_put(th, "}", 1);
+
+    /* never split an event between two buffers */
+    if (th->buf->len + th->ev_len > SFILE_TRACE_BUFSIZE)
+        trace_submit(th);
+    if (th->ev_len > SFILE_TRACE_BUFSIZE)
+        trace_write(th->t, th->ev, th->ev_len);
+    else {
+        memcpy(th->buf->data + th->buf->len, th->ev, th->ev_len);
+        th->buf->len += th->ev_len;
+    }
+}
+
+/* buffer of the calling thread */
+static struct trace_thread_s *
+trace_thread(struct sfile_ctx_s *x)
+{
+    struct trace_thread_s *th = trace_self;
+
+    if (th && th->t == x->trace)
+        return th;
+    th = xmalloc(sizeof(struct trace_thread_s));
+    memset(th, 0, sizeof(struct trace_thread_s));
+    th->t = x->trace;
+    th->buf = xmalloc(sizeof(struct trace_buf_s));
+    th->buf->len = 0;
+    pthread_mutex_lock(&th->t->lock);
+    th->tid = ++th->t->n_tid;
+    pthread_mutex_unlock(&th->t->lock);
+    trace_self = th;
+    return th;
+}
+
+/* give the events of the calling thread to the flusher */
+static void
+trace_thread_exit(struct sfile_ctx_s *x)
+{
+    struct trace_thread_s *th = trace_self;
+
+    if (!x->trace || !th || th->t != x->trace)
+        return;
+    trace_submit(th);
+    xfree(th->buf);
+    xfree(th->ev);
+    xfree(th);
+    trace_self = NULL;
+}
+
+/* queue the buffer of th for the flusher, and take a new one */
+static void
+trace_submit(struct trace_thread_s *th)
+{
+    struct sfile_trace_s *t = th->t;
+
+    if (!th->buf->len)
+        return;
+    th->buf->next = NULL;
+    pthread_mutex_lock(&t->lock);
+    if (t->full)
+        t->full_tail->next = th->buf;
+    else
+        t->full = th->buf;
+    t->full_tail = th->buf;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    th->buf = xmalloc(sizeof(struct trace_buf_s));
+    th->buf->len = 0;
+}
+
+static void *
+trace_flusher(void *data)
+{
+    struct sfile_trace_s *t = data;
+    struct trace_buf_s *buf = NULL;
+
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        while (!t->full && !t->closed)
+            pthread_cond_wait(&t->cond, &t->lock);
+        if (!t->full)
+            break;
+        buf = t->full;
+        t->full = buf->next;
+        pthread_mutex_unlock(&t->lock);
+        trace_write(t, buf->data, buf->len);
+        xfree(buf);
+        pthread_mutex_lock(&t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+/* write whole events, errors are ignored */
+static void
+trace_write(struct sfile_trace_s *t, const char *data, size_t len)
+{
+    ssize_t ret;
+
+    pthread_mutex_lock(&t->write_lock);
+    while (len) {
+        ret = write(t->fd, data, len);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        data += ret;
+        len -= (size_t) ret;
+    }
+    pthread_mutex_unlock(&t->write_lock);
+}
+
+/* append to the event being formatted */
+static void
+trace_put(struct trace_thread_s *th, const char *str, size_t len)
+{
+    if (th->ev_len + len > th->ev_size) {
+        while (th->ev_len + len > th->ev_size)
+            th->ev_size = th->ev_size ? th->ev_size * 2 : 256;
+        th->ev = realloc(th->ev, th->ev_size);
+        if (!th->ev)
+            out_memory("realloc");
+    }
+    memcpy(th->ev + th->ev_len, str, len);
+    th->ev_len += len;
+}
+
+static void
+trace_put_json(struct trace_thread_s *th, const char *str)
+{
+    char esc[8];
+    const char *p = NULL;
+
+    trace_put(th, "\"", 1);
+    for (p = str; *p; p++) {
+        if (*p != '"' && *p != '\\' && (unsigned char) *p >= 0x20)
+            continue;
+        trace_put(th, str, (size_t) (p - str));
+        if (*p == '"' || *p == '\\') {
+            esc[0] = '\\';
+            esc[1] = *p;
+            trace_put(th, esc, 2);
+        }
+        else {
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char) *p);
+            trace_put(th, esc, 6);
+        }
+        str = p + 1;
+    }
+    trace_put(th, str, (size_t) (p - str));
+    trace_put(th, "\"", 1);
+}
+
+static void
+queue_init(struct queue_s *q, size_t size)
+{
+    q->x = NULL;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->items = xmalloc(size * sizeof(void *));
+    q->size = size;
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+}
+
+static void
+queue_free(struct queue_s *q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    xfree(q->items);
+}
+
+/* wait for a free place if queue is full */
+static void
+queue_push(struct queue_s *q, void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->size)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    q->items[(q->head + q->count) % q->size] = item;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* return NULL when queue is closed and empty */
+static void *
+queue_pop(struct queue_s *q)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (!q->count && !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    if (q->count) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->size;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static void
+queue_close(struct queue_s *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *ptr = NULL;
+
+    if (!size)
+        size++;
+    ptr = malloc(size);
+    if (!ptr)
+        out_memory("malloc");
+    return ptr;
+}
+
+static char *
+xstrdup(const char *str)
+{
+    char *copy = NULL;
+
+    copy = strdup(str);
+    if (!copy)
+        out_memory("strdup");
+    return copy;
+}
+
+static void
+xfree(void *ptr)
+{
+    if (ptr)
+        free(ptr);
+}
+
+/* free an array of sfile_parse_str_array() */
+void
+sfile_free_str_array(char **array)
+{
+    int i;
+
+    if (array) {
+        for (i = 0; array[i]; i++)
+            xfree(array[i]);
+        xfree(array);
+    }
+}
+
+static void
+out_memory(const char *func_name)
+{
+    fprintf(stderr, "libsfile:%s: memory exhausted\n", func_name);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * NULL terminated array of the items of a list "a,b,c", to free with
+ * sfile_free_str_array(). NULL with errno ENOMEM if memory is
+ * exhausted, the caller is not stopped.
+ */
+char **
+sfile_parse_str_array(const char *arg)
+{
+    int i;
+    char *copy = NULL;
+    char *item = NULL;
+    char *save = NULL;
+    char **array = NULL;
+
+    copy = strdup(arg);
+    if (!copy)
+        return NULL;
+    i = 2; /* string + final NULL */
+    for (; *arg; arg++) {
+        if (*arg == ',')
+            i++;
+    }
+
+    array = malloc(((size_t) i) * sizeof(char *));
+    if (!array) {
+        xfree(copy);
+        return NULL;
+    }
+    i = 0;
+    item = strtok_r(copy, ",", &save);
+    while (item) {
+        array[i] = strdup(item);
+        if (!array[i]) {
+            sfile_free_str_array(array);
+            xfree(copy);
+            errno = ENOMEM;
+            return NULL;
+        }
+        array[++i] = NULL;
+        item = strtok_r(NULL, ",", &save);
+    }
+    xfree(copy);
+    array[i] = NULL;
+    return array;
+}
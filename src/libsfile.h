@@ -0,0 +1,390 @@
+/*
+ *  sfile
+ *  src/libsfile.h
+ *
+ *  Author: Vilmain Nicolas
+ *  Contact: nicolas.vilmain@gmail.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBSFILE_H
+#define LIBSFILE_H
+
+#include  <stdio.h>
+#include  <stdint.h>
+#include  <pthread.h>
+#include  <stdatomic.h>
+#include  <sys/types.h>
+#include  <sys/stat.h>
+
+#ifndef LINE_BUFSIZE
+# define LINE_BUFSIZE 4096
+#endif /* !LINE_BUFSIZE */
+
+#ifndef SFILE_QUEUE_PER_JOB
+# define SFILE_QUEUE_PER_JOB 16
+#endif /* !SFILE_QUEUE_PER_JOB */
+
+#ifndef SFILE_PREFETCH
+# define SFILE_PREFETCH 4
+#endif /* !SFILE_PREFETCH */
+
+/* files changed in the last seconds are read, not mapped */
+#ifndef SFILE_MMAP_AGE
+# define SFILE_MMAP_AGE 60
+#endif /* !SFILE_MMAP_AGE */
+
+#ifndef SFILE_THROTTLE_CHUNK
+# define SFILE_THROTTLE_CHUNK 65536
+#endif /* !SFILE_THROTTLE_CHUNK */
+
+#ifndef SFILE_TRACE_BUFSIZE
+# define SFILE_TRACE_BUFSIZE 65536
+#endif /* !SFILE_TRACE_BUFSIZE */
+
+#ifndef SFILE_COLD_QUEUE
+# define SFILE_COLD_QUEUE 1024
+#endif /* !SFILE_COLD_QUEUE */
+
+#ifndef SFILE_COLD_READERS
+# define SFILE_COLD_READERS 4
+#endif /* !SFILE_COLD_READERS */
+
+#ifndef SFILE_CACHE_PROBE
+# define SFILE_CACHE_PROBE 1048576
+#endif /* !SFILE_CACHE_PROBE */
+
+#ifndef SFILE_SAMPLE_ENTRIES
+# define SFILE_SAMPLE_ENTRIES 8
+#endif /* !SFILE_SAMPLE_ENTRIES */
+
+#ifndef SFILE_SAMPLE_MIN_PROBES
+# define SFILE_SAMPLE_MIN_PROBES 30
+#endif /* !SFILE_SAMPLE_MIN_PROBES */
+
+#ifndef SFILE_FUZZY_MAX_DIST
+# define SFILE_FUZZY_MAX_DIST 8
+#endif /* !SFILE_FUZZY_MAX_DIST */
+
+#ifndef ENV_VAR_PATH
+# define ENV_VAR_PATH "PATH"
+#endif /* !ENV_VAR_PATH */
+
+/* enumeration of all x->opts value */
+enum sfile_options_values {
+    /* default mode, just list file in current directory */
+    O_LS_MODE = 0x00000001,
+
+    /* list all object in directory */
+    O_ALL = 0x00000002,
+
+    /* search in dir to the $PATH variable */
+    O_ENV_PATH = 0x00000004,
+
+    /* set recursive mode */
+    O_RECURSIVE = 0x00000008,
+
+    /* ignore all directory */
+    O_IGN_DIR = 0x00000010,
+
+    /* ignore regular file */
+    O_IGN_FILE = 0x00000020,
+
+    /* ignore backup (file ending by ~) */
+    O_IGN_BACKUP = 0x00000040,
+
+    /* ignore archive */
+    O_IGN_ARCHIVE = 0x00000080,
+
+    /* print object full path */
+    O_FULL_PATH = 0x00000100,
+
+    /* color output (not used by the library) */
+    O_COLOR = 0x00000200,
+
+    /* print inode to find object (not used by the library) */
+    O_PUT_INODE = 0x00000400,
+
+    /* print number line to find word */
+    O_NUM_LINE = 0x00000800,
+
+    /* print file informations (not used by the library) */
+    O_FILE_INFOS = 0x00001000,
+
+    /* print first line to find word */
+    O_PRINT = 0x00002000,
+
+    /* print all line to find word */
+    O_ALL_PRINT = 0x00004000,
+
+    /* Ignore case distinctions in file word */
+    O_IGN_CASE_IN_FILE = 0x00008000,
+
+    /* Ignore case distinctions in file name */
+    O_IGN_CASE_FILE_NAME = 0x00010000,
+
+    /* Count number result for word in file options */
+    O_WIF_COUNT = 0x00020000,
+
+    /* NUL terminated path output (not used by the library) */
+    O_PRINT0 = 0x00040000,
+
+    /* JSON lines output (not used by the library) */
+    O_JSON = 0x00080000,
+
+    /* do not descend in directories on other file systems */
+    O_ONE_FS = 0x00100000,
+
+    /* follow symbolic links */
+    O_FOLLOW_LINK = 0x00200000,
+
+    /* lstat and open directory entries by inode number */
+    O_INODE_ORDER = 0x00400000,
+
+    /* open files with O_NOATIME */
+    O_READ_NOATIME = 0x00800000,
+
+    /* do not keep read files in page cache */
+    O_READ_NOCACHE = 0x01000000,
+
+    /* check name matches and small files first, directories by depth */
+    O_FIRST_FAST = 0x02000000,
+
+    /* search files in page cache first, the others by cold readers */
+    O_CACHE_FIRST = 0x04000000
+};
+
+/* n_exit result reached or scan stopped by the callback */
+#define SFILE_STOPPED(x) atomic_load_explicit(&(x)->stop, memory_order_relaxed)
+
+enum file_type_e {
+    TF_REG,
+    TF_DIR,
+    TF_BACKUP,
+    TF_ARCHIVE,
+    TF_OTHER,
+    TF_ERROR,
+};
+
+/*
+ * Line of a result. line points in the file buffer: it is not NUL
+ * terminated (len characters, without '\n') and is NULL if the text
+ * is not printed (-p, -V).
+ */
+struct line_s {
+    long n;
+    long off;     /* byte offset of the match (of the line if context) */
+    size_t col;   /* offset of the match in line */
+    size_t len;
+    size_t match_len;  /* bytes of the match, 0 for context lines */
+    int context;  /* 1 for --before and --after lines */
+    const char *line;
+#define LINE_S(y)    ((struct line_s *) y->un.data)->line
+#define LINE_N(y)    ((struct line_s *) y->un.data)->n
+#define LINE_OFF(y)  ((struct line_s *) y->un.data)->off
+#define LINE_COL(y)  ((struct line_s *) y->un.data)->col
+#define LINE_LEN(y)  ((struct line_s *) y->un.data)->len
+#define LINE_MLEN(y) ((struct line_s *) y->un.data)->match_len
+#define LINE_CTX(y)  ((struct line_s *) y->un.data)->context
+};
+
+struct stack_chunk_s {
+    union {
+        void *data;
+        char *str;
+    } un;
+    struct stack_chunk_s *next;
+};
+
+struct stack_s {
+    struct stack_chunk_s *tail;
+    struct stack_chunk_s *chunk;
+};
+
+/* file system type of a device, for --skip-fstype */
+struct sfile_devcache_s {
+    dev_t dev;
+    int skip;
+};
+
+/* token bucket, rate by second and burst of one second */
+struct sfile_bucket_s {
+    double rate;
+    double tokens;
+    double last;
+};
+
+/* --max-read-rate, --max-iops and --max-cpu state */
+struct sfile_throttle_s {
+    int enabled;
+    pthread_mutex_t lock;
+    struct sfile_bucket_s bytes;
+    struct sfile_bucket_s ops;
+    double cpu_start;
+    double wall_start;
+};
+
+struct sfile_trace_s;
+struct sfile_fuzzy_s;
+struct sfile_fold_s;
+struct sfile_sums_s;
+struct sfile_cold_s;
+struct sfile_sample_s;
+
+/*
+ * One result given to the result callback.
+ * All pointers are owned by the library and only valid
+ * during the callback call.
+ */
+struct sfile_result_s {
+    const char *path;
+    const char *name;
+    enum file_type_e type;
+    const struct stat *st;
+    unsigned long n_match;        /* number of matches (-i) */
+    struct stack_chunk_s *lines;  /* list of struct line_s or NULL */
+};
+
+/* Return not 0 to stop the scan. */
+typedef int (*sfile_result_cb)(const struct sfile_result_s *res, void *data);
+
+/*
+ * Totals of the results of a directory (summary_depth), dir is owned
+ * by the library. blocks is the allocated size in bytes.
+ */
+struct sfile_summary_s {
+    char *dir;
+    unsigned long n_entries;
+    unsigned long n_type[TF_ERROR + 1];  /* by enum file_type_e */
+    unsigned long long size;
+    unsigned long long blocks;
+    unsigned long long n_match;
+};
+
+/* Return not 0 to stop the rows. */
+typedef int (*sfile_summary_cb)(const struct sfile_summary_s *sum,
+                                void *data);
+
+/* estimated total and its 95% confidence interval */
+struct sfile_interval_s {
+    double value;
+    double low;
+    double high;
+};
+
+/*
+ * Totals of a scan estimated by estimate_fraction or estimate_time,
+ * from n_probes random descents of the scanned directories.
+ */
+struct sfile_estimate_s {
+    unsigned long n_probes;
+    unsigned long n_dirs;     /* directories read */
+    unsigned long n_checked;  /* entries checked */
+    double seconds;
+    struct sfile_interval_s entries;
+    struct sfile_interval_s bytes;    /* size of the regular files */
+    struct sfile_interval_s results;
+    struct sfile_interval_s matches;  /* n_match of the results */
+};
+
+typedef void (*sfile_estimate_cb)(const struct sfile_estimate_s *est,
+                                  void *data);
+
+/*
+ * Search context, set fields after sfile_init(),
+ * call sfile_prepare() and scan with sfile_scan_path().
+ * A context is used by one scan at a time, but several contexts
+ * can run in the same process.
+ * With n_jobs > 1 the result callback is called by the worker
+ * threads, one call at a time.
+ */
+struct sfile_ctx_s {
+    int n_exit;
+    int n_jobs;
+    int n_slow_jobs;  /* threads for rotational/network devices, 0: auto */
+    int max_cpu;          /* percent of one CPU, 0: no limit */
+    double max_read_rate; /* MB by second, 0: no limit */
+    double max_iops;      /* open, stat and read by second, 0: no limit */
+    int shard_i;          /* --shard: this shard, from 0 to shard_n - 1 */
+    int shard_n;          /* number of shards, 0: no sharding */
+    int shard_depth;      /* entries at this depth move with their subtree */
+    int before_ctx;       /* context lines before printed lines */
+    int after_ctx;        /* context lines after printed lines */
+    int byuid;
+    int byino;
+    uint32_t opts;
+    char *ext;
+    char *wif;   /* Word In File */
+    char *win;   /* Word In Name */
+    char *wnf;   /* Word Name File */
+    char *fuzzy;       /* --fuzzy-name, 64 characters max */
+    int fuzzy_dist;    /* max edit distance */
+    int fuzzy_top_n;   /* number of results kept */
+    int summary_depth; /* totals by directory to this depth, -1: off */
+    double estimate_fraction;  /* sample this part of the entries */
+    double estimate_time;      /* else sample for seconds, 0: off */
+    char *ign;
+    char **ign_ext;
+    char **skip_fstype;    /* do not descend in this file systems */
+    struct sfile_devcache_s *dev_cache;
+    size_t n_dev_cache;
+    const char *prog_name;  /* prefix for error messages */
+    sfile_result_cb result_cb;
+    void *result_data;
+    sfile_summary_cb summary_cb;
+    void *summary_data;
+    sfile_estimate_cb estimate_cb;
+    void *estimate_data;
+    char *(*searchmem_wif)(const char *, size_t, const char *, size_t);
+    char *(*searchstring_win)(const char *, const char *);
+    int (*cmpstring_wnf)(const char *, const char *);
+    int filter_mode;       /* set by sfile_prepare() */
+    pthread_mutex_t lock;  /* result callback and n_exit */
+    atomic_int stop;       /* read without lock, see SFILE_STOPPED() */
+    pthread_mutex_t dev_lock;  /* dev_cache */
+    struct sfile_throttle_s throttle;
+    struct sfile_trace_s *trace;  /* see sfile_trace_open() */
+    struct sfile_fuzzy_s *fuzzy_top;  /* results for sfile_finish() */
+    struct sfile_fold_s *fold_win;  /* folded needles, by sfile_prepare() */
+    struct sfile_fold_s *fold_wnf;
+    struct sfile_fold_s *fold_wif;
+    struct sfile_sums_s *summary;   /* totals of summary_depth */
+    struct sfile_cold_s *cold;      /* O_CACHE_FIRST queue */
+    struct sfile_sample_s *sample;  /* state of the estimate */
+    struct sfile_ctx_s **queries;  /* see sfile_add_query() */
+    size_t n_queries;
+    struct sfile_ctx_s *walk;      /* scan of this query, else NULL */
+};
+
+void sfile_init(struct sfile_ctx_s *x);
+void sfile_free(struct sfile_ctx_s *x);
+void sfile_set_callback(struct sfile_ctx_s *x, sfile_result_cb cb, void *data);
+void sfile_set_summary_callback(struct sfile_ctx_s *x, sfile_summary_cb cb,
+                                void *data);
+void sfile_set_estimate_callback(struct sfile_ctx_s *x, sfile_estimate_cb cb,
+                                 void *data);
+void sfile_add_query(struct sfile_ctx_s *x, struct sfile_ctx_s *q);
+void sfile_prepare(struct sfile_ctx_s *x);
+int sfile_scan_path(struct sfile_ctx_s *x, const char *path);
+int sfile_scan_paths(struct sfile_ctx_s *x, char **paths, int n_paths);
+void sfile_scan_path_environ(struct sfile_ctx_s *x);
+int sfile_scan_stream(struct sfile_ctx_s *x, FILE *stream, int delim);
+void sfile_finish(struct sfile_ctx_s *x);
+int sfile_trace_open(struct sfile_ctx_s *x, const char *path);
+void sfile_trace_close(struct sfile_ctx_s *x);
+char **sfile_parse_str_array(const char *arg);
+void sfile_free_str_array(char **array);
+
+#endif /* not have LIBSFILE_H */
@@ -20,52 +20,47 @@
  */
 
 #include  <pwd.h>
+#include  <ctype.h>
+#include  <math.h>
 #include  <errno.h>
 #include  <stdio.h>
-#include  <ctype.h>
+#include  <stdarg.h>
 #include  <stdlib.h>
 #include  <string.h>
-#include  <strings.h>
-#include  <dirent.h>
 #include  <unistd.h>
 #include  <sys/stat.h>
 #include  "sfile.h"
 
 const char *program_name;
 
+/* names of enum file_type_e for JSON */
+static const char *type_name[] =
+     {"reg", "dir", "backup", "archive", "other", "error"};
+
 int
 main(int argc, char **argv)
 {
-    struct opt_s x;
+    struct sfile_ctx_s x;
+    struct out_s out;
+    struct cli_s cli;
 
     set_program_name(argv[0]);
     sfile_init(&x);
-    decode_program_param(argc, argv, &x);
-    scan_arg_object(argc, argv, &x);
+    x.prog_name = program_name;
+    out_init(&out, STDOUT_FILENO);
+    init_cli(&cli, &x, &out, stdout);
+    decode_program_param(argc, argv, &cli);
+    sfile_set_callback(&x, select_print_object(&x), &cli);
+    sfile_set_summary_callback(&x, print_summary_object, &cli);
+    sfile_set_estimate_callback(&x, print_estimate_object, &cli);
+    scan_arg_object(argc, argv, &cli);
+    sfile_finish(&x);
+    free_queries(&cli);
+    close_output(&cli);
     sfile_free(&x);
     return EXIT_SUCCESS;
 }
 
-void
-sfile_init(struct opt_s *x)
-{
-    memset(x, 0, sizeof(struct opt_s));
-    x->byino = -1;
-    x->byuid = -1;
-    x->n_exit = -1;
-}
-
-void
-sfile_free(struct opt_s *x)
-{
-    xfree(x->ign);
-    xfree(x->ext);
-    xfree(x->wif);
-    xfree(x->win);
-    xfree(x->wnf);
-    free_str_array(x->ign_ext);
-}
-
 void
 set_program_name(const char *arg0)
 {
@@ -78,12 +73,30 @@ set_program_name(const char *arg0)
 }
 
 void
-decode_program_param(int argc, char **argv, struct opt_s *x)
+init_cli(struct cli_s *cli, struct sfile_ctx_s *x, struct out_s *out,
+         FILE *stream)
+{
+    cli->x = x;
+    cli->out = out;
+    cli->stream = stream;
+    cli->output = NULL;
+    cli->files_from = NULL;
+    cli->delim = '\n';
+    cli->queries = NULL;
+    cli->next = NULL;
+    cli->n_summary = 0;
+}
+
+void
+decode_program_param(int argc, char **argv, struct cli_s *cli)
 {
     int current_arg;
+    char c;
+    struct sfile_ctx_s *x = cli->x;
 
     if (argc == 1) {
         x->opts = O_LS_MODE;
+        sfile_prepare(x);
         return;
     }
     do {
@@ -140,6 +153,110 @@ decode_program_param(int argc, char **argv, struct opt_s *x)
         case 'x':
             x->n_exit = xstrtol_fatal(optarg, "invalid argument -x, --exit");
             break;
+        case 'j':
+            x->n_jobs = xstrtol_fatal(optarg, "invalid argument -j, --jobs");
+            if (x->n_jobs < 1)
+                x->n_jobs = 1;
+            break;
+        case OPT_SLOW_JOBS:
+            x->n_slow_jobs = xstrtol_fatal(optarg,
+                                           "invalid argument --slow-jobs");
+            if (x->n_slow_jobs < 1)
+                x->n_slow_jobs = 1;
+            break;
+        case OPT_MAX_READ_RATE:
+            x->max_read_rate = xstrtod_fatal(optarg,
+                                             "invalid argument --max-read-rate");
+            break;
+        case OPT_MAX_IOPS:
+            x->max_iops = xstrtod_fatal(optarg, "invalid argument --max-iops");
+            break;
+        case OPT_MAX_CPU:
+            x->max_cpu = xstrtol_fatal(optarg, "invalid argument --max-cpu");
+            break;
+        case OPT_NOATIME:
+            x->opts |= O_READ_NOATIME;
+            break;
+        case OPT_DROP_CACHE:
+            x->opts |= O_READ_NOCACHE;
+            break;
+        case OPT_AFTER:
+            x->after_ctx = xstrtol_fatal(optarg, "invalid argument --after");
+            break;
+        case OPT_BEFORE:
+            x->before_ctx = xstrtol_fatal(optarg,
+                                          "invalid argument --before");
+            break;
+        case OPT_CONTEXT:
+            x->after_ctx = xstrtol_fatal(optarg,
+                                         "invalid argument --context");
+            x->before_ctx = x->after_ctx;
+            break;
+        case OPT_FUZZY_NAME:
+            if (strlen(optarg) > 64) {
+                fprintf(stderr, "%s:--fuzzy-name: 64 characters max\n",
+                        program_name);
+                exit(EXIT_FAILURE);
+            }
+            xfree(x->fuzzy);
+            x->fuzzy = xstrdup(optarg);
+            break;
+        case OPT_FUZZY_DIST:
+            x->fuzzy_dist = xstrtol_fatal(optarg,
+                                          "invalid argument --fuzzy-distance");
+            break;
+        case OPT_FUZZY_TOP:
+            x->fuzzy_top_n = xstrtol_fatal(optarg,
+                                           "invalid argument --fuzzy-top");
+            break;
+        case OPT_SUMMARY:
+            x->summary_depth = optarg ?
+                xstrtol_fatal(optarg, "invalid argument --summary") : 1;
+            if (x->summary_depth < 0) {
+                fprintf(stderr, "%s:strtol: invalid argument --summary\n",
+                        program_name);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_ESTIMATE:
+            parse_estimate(x, optarg);
+            break;
+        case OPT_OUTPUT:
+            xfree(cli->output);
+            cli->output = xstrdup(optarg);
+            break;
+        case OPT_QUERIES:
+            xfree(cli->queries);
+            cli->queries = xstrdup(optarg);
+            break;
+        case OPT_TRACE:
+            sfile_trace_close(x);
+            if (sfile_trace_open(x, optarg)) {
+                fprintf(stderr, "%s:--trace `%s': %s\n", program_name,
+                        optarg, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_CACHE_FIRST:
+            x->opts |= O_CACHE_FIRST;
+            break;
+        case OPT_FIRST_FAST:
+            x->opts |= O_FIRST_FAST;
+            break;
+        case OPT_SHARD:
+            if (sscanf(optarg, "%d/%d%c", &x->shard_i, &x->shard_n,
+                       &c) != 2 || x->shard_n < 1 ||
+                x->shard_i < 1 || x->shard_i > x->shard_n) {
+                fprintf(stderr, "%s: invalid argument --shard: `%s'\n",
+                        program_name, optarg);
+                exit(EXIT_FAILURE);
+            }
+            x->shard_i--;
+            break;
+        case OPT_SHARD_DEPTH:
+            x->shard_depth = xstrtol_fatal(optarg,
+                                           "invalid argument --shard-depth");
+            break;
         case 'Q':
             x->byino = xstrtol_fatal(optarg, "invalid argument -Q, --inode");
             break;
@@ -179,8 +296,34 @@ decode_program_param(int argc, char **argv, struct opt_s *x)
             x->opts |= (O_IGN_CASE_FILE_NAME | O_IGN_CASE_IN_FILE);
             break;
         case 'G':
-            free_str_array(x->ign_ext);
-            x->ign_ext = parse_str_array(optarg);
+            sfile_free_str_array(x->ign_ext);
+            x->ign_ext = xparse_str_array(optarg);
+            break;
+        case OPT_PRINT0:
+            x->opts |= O_PRINT0;
+            break;
+        case OPT_JSON:
+            x->opts |= O_JSON;
+            break;
+        case OPT_FILES_FROM:
+            xfree(cli->files_from);
+            cli->files_from = xstrdup(optarg);
+            break;
+        case OPT_NULL:
+            cli->delim = '\0';
+            break;
+        case OPT_ONE_FS:
+            x->opts |= O_ONE_FS;
+            break;
+        case OPT_SKIP_FSTYPE:
+            sfile_free_str_array(x->skip_fstype);
+            x->skip_fstype = xparse_str_array(optarg);
+            break;
+        case OPT_FOLLOW:
+            x->opts |= O_FOLLOW_LINK;
+            break;
+        case OPT_INODE_ORDER:
+            x->opts |= O_INODE_ORDER;
             break;
         case OPT_ACK_LIKE:
             x->opts |= O_ALL_PRINT | O_PRINT | O_FULL_PATH | O_RECURSIVE |
@@ -192,393 +335,455 @@ decode_program_param(int argc, char **argv, struct opt_s *x)
             break;
         }
     } while (current_arg != -1);
-    if (!x->wif && !x->win && !x->wnf && !x->ext &&
-        x->byuid == -1 && x->byino == -1) {
-        x->opts |= O_LS_MODE;
-    }
-
-    /* Set pointer on string search/cmp functions by options. */
-    x->cmpstring_wnf = strcmp;
-    x->searchstring_win = strstr;
-    if ((x->opts & O_IGN_CASE_FILE_NAME)) {
-        x->cmpstring_wnf = strcasecmp;
-        x->searchstring_win = xstrcasestr;
-    }
-
-    x->searchstring_wif = strstr;
-    if ((x->opts & O_IGN_CASE_IN_FILE)) {
-        x->searchstring_wif = xstrcasestr;
+    /* context is for printed lines, print all by default */
+    if ((x->before_ctx || x->after_ctx) &&
+        !(x->opts & (O_PRINT | O_ALL_PRINT)))
+        x->opts |= O_ALL_PRINT;
+    /* keep line of the matches for the "text" field */
+    if ((x->opts & O_JSON) && !(x->opts & O_ALL_PRINT))
+        x->opts |= O_PRINT;
+    if (cli->queries &&
+        (x->estimate_fraction > 0 || x->estimate_time > 0)) {
+        fprintf(stderr, "%s: --estimate does not work with --queries\n",
+                program_name);
+        exit(EXIT_FAILURE);
     }
+    if (cli->output)
+        open_output(cli);
+    if (cli->queries)
+        read_queries(cli);
+    sfile_prepare(x);
 }
 
+/*
+ * --estimate[=FRACTION|=TIME]: FRACTION of the entries (0.01 or 1%),
+ * or TIME seconds for each scanned path (30s, 5m, 1h), 10s by default.
+ */
 void
-scan_arg_object(int argc, char **argv, struct opt_s *x)
+parse_estimate(struct sfile_ctx_s *x, const char *arg)
 {
-    struct finfo_s finfo;
+    double val;
+    char *end = NULL;
 
-    if ((x->opts & O_ENV_PATH))
-        scan_path_environ(x);
-    if (x->n_exit) {
-        do {
-            memset(&finfo, 0, sizeof(struct finfo_s));
-            if ((argc - optind))
-                strncpy(finfo.fi_path, argv[optind++], PATH_LEN_USE);
-            set_object_path(finfo.fi_path, (x->opts & O_FULL_PATH));
-            finfo.fi_type = get_file_type(&finfo);
-            if (finfo.fi_type != TF_ERROR) {
-                if (finfo.fi_type == TF_DIR)
-                    list_dir_object(x, finfo.fi_path);
-                else {
-                    finfo.fi_name = strrchr(finfo.fi_path, '/');
-                    if (!finfo.fi_name)
-                        finfo.fi_name = finfo.fi_path;
-                    else
-                        finfo.fi_name++;
-                    check_object(x, &finfo);
-                }
-            }
-        } while ((optind - argc) && x->n_exit);
+    x->estimate_fraction = 0;
+    x->estimate_time = 10;
+    if (!arg)
+        return;
+    val = strtod(arg, &end);
+    if (end == arg || val <= 0 || (end[0] && end[1]))
+        end = NULL;
+    else if (!end[0] && val <= 1)
+        x->estimate_fraction = val;
+    else if (end[0] == '%' && val <= 100)
+        x->estimate_fraction = val / 100;
+    else if (end[0] == 's')
+        x->estimate_time = val;
+    else if (end[0] == 'm')
+        x->estimate_time = val * 60;
+    else if (end[0] == 'h')
+        x->estimate_time = val * 3600;
+    else
+        end = NULL;
+    if (!end) {
+        fprintf(stderr, "%s: invalid argument --estimate: `%s'\n",
+                program_name, arg);
+        exit(EXIT_FAILURE);
     }
+    if (x->estimate_fraction > 0)
+        x->estimate_time = 0;
 }
 
+/* --output FILE, for the print functions and the out buffer */
 void
-scan_path_environ(struct opt_s *x)
+open_output(struct cli_s *cli)
 {
-    char *envpath = NULL;
-    char *buf = NULL;
-
-    envpath = getenv("PATH");
-    if (!envpath || !envpath[0]) {
-#ifndef NDEBUG
-        fprintf(stderr, "Environement variable `%s' not set or is empty.",
-                ENV_VAR_PATH);
-#endif /* NDEBUG */
-        return;
-    }
-
-    buf = strtok(envpath, ":");
-    while (buf && x->n_exit) {
-        list_dir_object(x, buf);
-        buf = strtok(NULL, ":");
+    cli->stream = fopen(cli->output, "w");
+    if (!cli->stream) {
+        fprintf(stderr, "%s:fopen `%s': %s\n", program_name, cli->output,
+                strerror(errno));
+        exit(EXIT_FAILURE);
     }
+    cli->out = xmalloc(sizeof(struct out_s));
+    out_init(cli->out, fileno(cli->stream));
 }
 
 void
-set_object_path(char *name, uint32_t full)
+close_output(struct cli_s *cli)
 {
-#define PATH_LEN_TRUNCATED (PATH_LEN - 2) /* ./ gcc warning */
-    char buf[PATH_LEN_TRUNCATED];
-
-    /* if name begin by '/', it is already full path */
-    if (name[0] == '/')
-        return;
-    strncpy(buf, name, (PATH_LEN_TRUNCATED - 1));
-    /* set full path */
-    if (full) {
-        if (get_current_dir(name))
-            strncpy(name, buf, PATH_LEN);
-        strncat(name, buf, (PATH_LEN - strlen(name)));
-    }
-    else {
-        /* need add ./ */
-        if (name[0] != '.' && name[1] != '/')
-            snprintf(name, PATH_LEN, "./%s", buf);
+    out_flush(cli->out);
+    if (cli->output) {
+        fclose(cli->stream);
+        xfree(cli->out);
+        xfree(cli->output);
     }
+    xfree(cli->files_from);
+    xfree(cli->queries);
 }
 
-int
-get_current_dir(char *current_path)
+/*
+ * --queries FILE: one query by line, with the options of sfile
+ * (empty lines and lines beginning by # are ignored). The queries
+ * print in the output of the command line, or in their --output,
+ * and are checked in the scan of the command line.
+ */
+void
+read_queries(struct cli_s *cli)
 {
-    char *ret = NULL;
-    size_t len;
-
-    ret = getcwd(current_path, PATH_LEN_USE);
-    if (!ret) {
-        fprintf(stderr, "%s:getcwd: get current path fails\n",
-                program_name);
-        return -1;
+    int argc;
+    int save;
+    char *buf = NULL;
+    char **argv = NULL;
+    char *line = NULL;
+    size_t size;
+    ssize_t len;
+    FILE *stream = stdin;
+    struct cli_s *q = NULL;
+    struct cli_s **tail = &cli->next;
+
+    if (strcmp(cli->queries, "-")) {
+        stream = fopen(cli->queries, "r");
+        if (!stream) {
+            fprintf(stderr, "%s:fopen `%s': %s\n", program_name,
+                    cli->queries, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
     }
-    len = strlen(current_path);
-    if (current_path[len] != '/')
-        current_path[len] = '/';
-    return 0;
-}
-
-enum file_type_e
-get_file_type(struct finfo_s *fi)
-{
-    if (lstat(fi->fi_path, &fi->fi_stat) == -1) {
-        fprintf(stderr, "%s:lstat:path `%s': %s\n", program_name,
-                fi->fi_path, strerror(errno));
-        return TF_ERROR;
+    /* optind of the command line, for its paths */
+    save = optind;
+    size = 0;
+    while ((len = getline(&line, &size, stream)) != -1) {
+        if (len && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        argv = split_query_line(line, &argc, &buf);
+        if (argc > 1 && argv[1][0] != '#') {
+            q = xmalloc(sizeof(struct cli_s));
+            init_cli(q, xmalloc(sizeof(struct sfile_ctx_s)), cli->out,
+                     cli->stream);
+            sfile_init(q->x);
+            q->x->prog_name = program_name;
+            /* new getopt scan */
+#ifdef MACOS
+            optreset = 1;
+            optind = 1;
+#else
+            optind = 0;
+#endif /* MACOS */
+            decode_program_param(argc, argv, q);
+            if (optind < argc || q->queries || q->files_from ||
+                q->x->estimate_fraction > 0 || q->x->estimate_time > 0) {
+                fprintf(stderr, "%s:--queries: invalid query `%s'\n",
+                        program_name, line);
+                exit(EXIT_FAILURE);
+            }
+            if (query_scan_options(q->x)) {
+                fprintf(stderr, "%s:--queries: option of the scan in query "
+                        "`%s', set it on the command line\n",
+                        program_name, line);
+                exit(EXIT_FAILURE);
+            }
+            sfile_set_callback(q->x, select_print_object(q->x), q);
+            sfile_set_summary_callback(q->x, print_summary_object, q);
+            sfile_add_query(cli->x, q->x);
+            *tail = q;
+            tail = &q->next;
+        }
+        xfree(buf);
+        xfree(argv);
     }
-    if (S_ISDIR(fi->fi_stat.st_mode))
-        return TF_DIR;
-    else if (*(fi->fi_path
-               + (strlen(fi->fi_path) - 1)) == '~')
-        return TF_BACKUP;
-    else if (!object_is_archive(fi->fi_path))
-        return TF_ARCHIVE;
-    else if (S_ISREG(fi->fi_stat.st_mode))
-        return TF_REG;
-    return TF_OTHER;
+    optind = save;
+    free(line);
+    if (stream != stdin)
+        fclose(stream);
 }
 
+/*
+ * Options of the walk of the command line (-r, -a, -o, -j, -w, -P,
+ * --follow, ...), a query cannot change them.
+ */
 int
-object_is_archive(const char *name)
+query_scan_options(const struct sfile_ctx_s *x)
 {
-    const char **p_tab_archive = NULL;
-    char *ext = NULL;
-
-    ext = strrchr(name, '.');
-    if (ext) {
-        p_tab_archive = tab_archive;
-        do {
-            if (!strcmp(*p_tab_archive, ext))
-                return 0;
-        } while (*++p_tab_archive);
-    }
-    return -1;
+    return ((x->opts & (O_ALL | O_ENV_PATH | O_RECURSIVE | O_FULL_PATH |
+                        O_ONE_FS | O_FOLLOW_LINK | O_INODE_ORDER |
+                        O_READ_NOATIME | O_READ_NOCACHE | O_FIRST_FAST |
+                        O_CACHE_FIRST)) ||
+            x->ign || x->skip_fstype || x->n_jobs != 1 || x->n_slow_jobs ||
+            x->shard_n || x->shard_depth || x->max_read_rate > 0 ||
+            x->max_iops > 0 || x->max_cpu || x->trace);
 }
 
-void
-list_dir_object(struct opt_s *x, const char *path)
+/*
+ * Arguments of a query line, separated by blanks, with '...' and
+ * "..." quotes and \ escapes. argv[0] is the program name, the
+ * arguments are in *buf.
+ */
+char **
+split_query_line(const char *line, int *argc, char **buf)
 {
-    DIR *dir = NULL;
-    size_t len;
-    struct dirent *ent = NULL;
-    struct finfo_s fi;
-    struct stack_s dlist;
-    struct stack_chunk_s *p_next = NULL;
-
-    dlist.chunk = NULL;
-    dlist.tail = NULL;
-    push_dir_stack(&dlist, path);
-    do {
-        dir = opendir(dlist.chunk->un.str);
-        if (!dir) {
-            fprintf(stderr, "%s:opendir: path: `%s': %s\n", program_name,
-                    dlist.chunk->un.str, strerror(errno));
-        }
-        else {
-            x->p_current_path = dlist.chunk->un.str;
-            do {
-                ent = readdir(dir);
-                if (!ent)
-                    break;
-                if ((ent->d_name[0] != '.' ||
-                     (ent->d_name[0] == '.' && (x->opts & O_ALL) &&
-                      strcmp(ent->d_name, ".") &&
-                      strcmp(ent->d_name, ".."))) &&
-                    (!x->ign || (x->ign && !strstr(ent->d_name, x->ign)))) {
-                    memset(&fi, 0, sizeof(struct finfo_s));
-                    strncpy(fi.fi_path, dlist.chunk->un.str, PATH_LEN_USE);
-                    len = strlen(dlist.chunk->un.str);
-                    if (*(dlist.chunk->un.str + (len - 1)) != '/') {
-                        fi.fi_path[len] = '/';
-                    }
-                    strncat(fi.fi_path, ent->d_name, (PATH_LEN_USE - len));
-                    fi.fi_name = ent->d_name;
-                    check_object(x, &fi);
-                    if (fi.fi_type == TF_DIR && (x->opts & O_RECURSIVE))
-                        push_dir_stack(&dlist, fi.fi_path);
-                }
-            } while (x->n_exit);
-            closedir(dir);
-        }
-        if (dlist.chunk) {
-            p_next = dlist.chunk->next;
-            xfree(dlist.chunk->un.str);
-            xfree(dlist.chunk);
-            dlist.chunk = p_next;
+    int n;
+    char quote;
+    char *p = NULL;
+    char **argv = NULL;
+
+    argv = xmalloc((strlen(line) / 2 + 3) * sizeof(char *));
+    *buf = xmalloc(strlen(program_name) + strlen(line) + 2);
+    argv[0] = strcpy(*buf, program_name);
+    p = *buf + strlen(program_name) + 1;
+    n = 1;
+    for (;;) {
+        while (isspace((unsigned char) *line))
+            line++;
+        if (!*line)
+            break;
+        argv[n++] = p;
+        quote = '\0';
+        for (; *line && (quote || !isspace((unsigned char) *line)); line++) {
+            if (quote && *line == quote)
+                quote = '\0';
+            else if (!quote && (*line == '\'' || *line == '"'))
+                quote = *line;
+            else {
+                if (*line == '\\' && quote != '\'' && line[1])
+                    line++;
+                *p++ = *line;
+            }
         }
-    } while (x->n_exit && dlist.chunk);
+        *p++ = '\0';
+    }
+    argv[n] = NULL;
+    *argc = n;
+    return argv;
 }
 
 void
-check_object(struct opt_s *x, struct finfo_s *fi)
+free_queries(struct cli_s *cli)
 {
-    fi->fi_type = get_file_type(fi);
-    if (fi->fi_type == TF_ERROR)
-        return;
-
-    /* check filter */
-    if ( /* check ignore file type */
-         (fi->fi_type == TF_BACKUP && (x->opts & O_IGN_BACKUP)) ||
-         (fi->fi_type == TF_DIR && (x->opts & O_IGN_DIR)) ||
-         (fi->fi_type == TF_REG && (x->opts & O_IGN_FILE)) ||
-         (fi->fi_type == TF_ARCHIVE && (x->opts & O_IGN_ARCHIVE)) ||
-         /* check ignore and ignore by extension */
-         (x->ign_ext && !ign_file_extension(fi->fi_name, x->ign_ext)))
-        return;
-
-    x->n_wif_result = 0;
-    if (/* ls mode, list all file by default */
-         (x->opts & O_LS_MODE) ||
-         /* search by uid */
-         (x->byuid == (int) fi->fi_stat.st_uid) ||
-         /* is file inode ? */
-         (x->byino == (int) fi->fi_stat.st_ino) ||
-         /* search by file extension */
-         (x->ext && !cmp_file_extension(fi->fi_name, x->ext)) ||
-         /* search word in file name */
-         (x->win && x->searchstring_win(fi->fi_name, x->win)) ||
-         /* compar file name */
-         (x->wnf && !x->cmpstring_wnf(x->wnf, fi->fi_name)) ||
-         /* search word in file */
-         (x->wif && !word_in_file(x, fi->fi_path))) {
-        sfile_print_object(x, fi);
-        x->n_exit--;
+    struct cli_s *q = NULL;
+
+    while (cli->next) {
+        q = cli->next;
+        cli->next = q->next;
+        close_output(q);
+        sfile_free(q->x);
+        xfree(q->x);
+        xfree(q);
     }
 }
 
-int
-ign_file_extension(const char *name, char **ext)
+void
+scan_arg_object(int argc, char **argv, struct cli_s *cli)
 {
-    char *buf = NULL;
-    char **p_ext = NULL;
+    char empty[] = "";
+    char *cwd[1];
+    struct sfile_ctx_s *x = cli->x;
 
-    buf = strrchr(name, '.');
-    if (!buf)
-        return -1;
-
-    p_ext = ext;
-    while (*p_ext) {
-        if (!strcmp(buf, *p_ext))
-            return 0;
-        p_ext++;
+    if ((x->opts & O_ENV_PATH))
+        sfile_scan_path_environ(x);
+    if (cli->files_from) {
+        scan_files_from(cli);
+        /* paths only in the list */
+        if (argc == optind)
+            return;
+    }
+    if (argc == optind) {
+        /* without argument, scan the current directory */
+        cwd[0] = empty;
+        sfile_scan_paths(x, cwd, 1);
     }
-    return -1;
+    else
+        sfile_scan_paths(x, argv + optind, argc - optind);
 }
 
-int
-cmp_file_extension(const char *name, const char *ext)
+void
+scan_files_from(struct cli_s *cli)
 {
-    char *buf = NULL;
-
-    buf = strrchr(name, '.');
-    return (buf && !strcmp(buf, ext)) ? 0 : -1;
+    FILE *stream = stdin;
+
+    if (strcmp(cli->files_from, "-")) {
+        stream = fopen(cli->files_from, "r");
+        if (!stream) {
+            fprintf(stderr, "%s:fopen `%s': %s\n", program_name,
+                    cli->files_from, strerror(errno));
+            return;
+        }
+    }
+    sfile_scan_stream(cli->x, stream, cli->delim);
+    if (stream != stdin)
+        fclose(stream);
 }
 
-int
-word_in_file(struct opt_s *x, const char *path_file)
+/*
+ * Print function for the options, selected once:
+ * path only, else sfile_print_object().
+ */
+sfile_result_cb
+select_print_object(const struct sfile_ctx_s *x)
 {
-    long n_lines;
-    FILE *file = NULL;
-    char buf[LINE_BUFSIZE];
-
-    file = fopen(path_file, "r");
-    if (!file) {
-        fprintf(stderr, "%s:fopen `%s': %s\n",
-                program_name, path_file, strerror(errno));
-        return -1;
-    }
-
-    /* first line */
-    n_lines = 1;
-    do {
-        if (fgets(buf, LINE_BUFSIZE, file)) {
-            if (x->searchstring_wif(buf, x->wif)) {
-                x->n_wif_result++;
-                if ((x->opts & O_PRINT) ||
-                    (x->opts & O_ALL_PRINT) ||
-                    (x->opts & O_NUM_LINE)) {
-                    push_line_stack(&x->line, (x->opts &
-                                               (O_PRINT | O_ALL_PRINT)),
-                                    buf, n_lines);
-                }
-                if (!(x->opts & O_ALL_PRINT) && !(x->opts & O_WIF_COUNT)) {
-                    fclose(file);
-                    return 0;
-                }
-            }
-            if (strchr(buf, '\n'))
-                n_lines++;
-        }
-    } while (!feof(file) && !ferror(file));
-    fclose(file);
-
-    if (((x->opts & O_WIF_COUNT) && x->n_wif_result > 0) || x->line.tail)
-        return 0;
-    return -1;
+    if (!(x->opts & (O_JSON | O_PRINT0 | O_COLOR | O_FILE_INFOS |
+                     O_PUT_INODE | O_WIF_COUNT | O_FULL_PATH | O_PRINT |
+                     O_ALL_PRINT | O_NUM_LINE)))
+        return print_path_object;
+    return sfile_print_object;
 }
 
-
-void
-push_dir_stack(struct stack_s *stack, const char *path)
+/* same output as sfile_print_object() without options */
+int
+print_path_object(const struct sfile_result_s *res, void *data)
 {
-    struct stack_chunk_s *new = NULL;
+    struct cli_s *cli = data;
 
-    new = xmalloc(sizeof(struct stack_chunk_s));
-    if (stack->chunk) {
-        new->next = stack->chunk->next;
-        stack->chunk->next = new;
-    }
-    else {
-        stack->chunk = new;
-        new->next = NULL;
-    }
-    new->un.str = xstrdup(path);
+    return out_puts(cli->out, res->path) | out_puts(cli->out, " \n");
 }
 
-void
-push_line_stack(struct stack_s *stack, uint32_t print, char *line, long n)
+int
+sfile_print_object(const struct sfile_result_s *res, void *data)
 {
-    struct stack_chunk_s *new = NULL;
+    struct cli_s *cli = data;
+    struct sfile_ctx_s *x = cli->x;
+    struct out_s *out = cli->out;
 
-    new = xmalloc(sizeof(struct stack_chunk_s));
-    APPENDTOSTACK(stack, new);
-    new->un.data = xmalloc(sizeof(struct line_s));
-    LINE_S (new) = NULL;
-    if (print) {
-        if (line[strlen(line) - 1] == '\n')
-            line[strlen(line) - 1] = '\0';
-        LINE_S(new) = xstrdup(line);
-    }
-    LINE_N(new) = n;
-}
+    if ((x->opts & O_JSON))
+        return print_json_object(res, cli);
+    if ((x->opts & O_PRINT0))
+        return out_write(cli->out, res->path, strlen(res->path) + 1);
 
-void
-sfile_print_object(struct opt_s *x, struct finfo_s *fi)
-{
-    if (NEED_CUSTOM_OUTPUT(x) && x->line.chunk)
-        printf("\x1b[1;36;44m\x1B[37m"); /* set custom color */
+    if (NEED_CUSTOM_OUTPUT(x, res))
+        out_puts(out, "\x1b[1;36;44m\x1B[37m"); /* set custom color */
 
     if ((x->opts & O_FILE_INFOS)) {
-        print_perm_object(fi->fi_stat.st_mode);
-        print_user_object(fi->fi_stat.st_uid);
+        print_perm_object(out, res->st->st_mode);
+        print_user_object(out, res->st->st_uid);
 #ifdef MACOS
-        printf("\r\t\t\t %llu\r\t\t\t\t\t", fi->fi_stat.st_size);
+        out_printf(out, "\r\t\t\t %llu\r\t\t\t\t\t", res->st->st_size);
 #else
-        printf("%ld ", fi->fi_stat.st_size);
+        out_printf(out, "%ld ", res->st->st_size);
 #endif /* MACOS */
     }
 
     if ((x->opts & O_PUT_INODE)) {
 #ifdef MACOS
-        printf("(ino: %llu) ", fi->fi_stat.st_ino);
+        out_printf(out, "(ino: %llu) ", res->st->st_ino);
 #else
-        printf("(ino: %lu) ", fi->fi_stat.st_ino);
+        out_printf(out, "(ino: %lu) ", res->st->st_ino);
 #endif /* MACOS */
     }
 
-    if ((x->opts & O_WIF_COUNT) && x->n_wif_result) {
-        printf("(n_result: %lu) ", x->n_wif_result);
+    if ((x->opts & O_WIF_COUNT) && res->n_match) {
+        out_printf(out, "(n_result: %lu) ", res->n_match);
     }
 
-    print_object_name(fi, x);
+    print_object_name(res, cli);
 
-    if (x->line.tail) {
-        print_line_object(x->line.chunk, x);
-        x->line.chunk = NULL;
-        x->line.tail = NULL;
-    }
+    if (res->lines)
+        print_line_object(res->lines, res, cli);
     else
-        putchar('\n');
+        out_putc(out, '\n');
+    return 0;
+}
+
+/*
+ * One row of --summary: a table with a header, or with --json
+ * {"path":"...","entries":N,"types":{"reg":N,...},"size":N,
+ *  "allocated":N,"n_match":N}
+ */
+int
+print_summary_object(const struct sfile_summary_s *sum, void *data)
+{
+    int i;
+    int ret;
+    struct cli_s *cli = data;
+    struct out_s *out = cli->out;
+
+    if ((cli->x->opts & O_JSON)) {
+        ret = out_puts(out, "{\"path\":");
+        ret |= out_json_str(out, sum->dir, strlen(sum->dir));
+        ret |= out_puts(out, ",\"entries\":");
+        ret |= out_putnum(out, (long long) sum->n_entries);
+        ret |= out_puts(out, ",\"types\":{");
+        for (i = 0; i <= TF_ERROR; i++) {
+            ret |= out_putc(out, '"');
+            ret |= out_puts(out, type_name[i]);
+            ret |= out_puts(out, "\":");
+            ret |= out_putnum(out, (long long) sum->n_type[i]);
+            if (i < TF_ERROR)
+                ret |= out_putc(out, ',');
+        }
+        ret |= out_puts(out, "},\"size\":");
+        ret |= out_putnum(out, (long long) sum->size);
+        ret |= out_puts(out, ",\"allocated\":");
+        ret |= out_putnum(out, (long long) sum->blocks);
+        ret |= out_puts(out, ",\"n_match\":");
+        ret |= out_putnum(out, (long long) sum->n_match);
+        return ret | out_puts(out, "}\n");
+    }
+    if (!cli->n_summary++) {
+        out_printf(cli->out, "%10s %10s %10s %10s %14s %14s %10s  %s\n",
+                "ENTRIES", "FILES", "DIRS", "OTHER", "SIZE", "ALLOCATED",
+                "MATCHES", "DIRECTORY");
+    }
+    out_printf(cli->out, "%10lu %10lu %10lu %10lu %14llu %14llu %10llu  %s\n",
+            sum->n_entries,
+            sum->n_type[TF_REG] + sum->n_type[TF_BACKUP] +
+            sum->n_type[TF_ARCHIVE],
+            sum->n_type[TF_DIR], sum->n_type[TF_OTHER], sum->size,
+            sum->blocks, sum->n_match, sum->dir);
+    return 0;
 }
 
+/*
+ * Totals of --estimate, or with --json
+ * {"probes":N,"directories":N,"checked":N,"milliseconds":N,
+ *  "entries":{"value":N,"low":N,"high":N},"bytes":{...},...}
+ */
 void
-print_perm_object(mode_t mode)
+print_estimate_object(const struct sfile_estimate_s *est, void *data)
+{
+    int i;
+    struct cli_s *cli = data;
+    struct out_s *out = cli->out;
+    const char *name[] = {"entries", "bytes", "results", "matches"};
+    const struct sfile_interval_s *v[4];
+
+    v[0] = &est->entries;
+    v[1] = &est->bytes;
+    v[2] = &est->results;
+    v[3] = &est->matches;
+    if ((cli->x->opts & O_JSON)) {
+        out_puts(out, "{\"probes\":");
+        out_putnum(out, (long long) est->n_probes);
+        out_puts(out, ",\"directories\":");
+        out_putnum(out, (long long) est->n_dirs);
+        out_puts(out, ",\"checked\":");
+        out_putnum(out, (long long) est->n_checked);
+        out_puts(out, ",\"milliseconds\":");
+        out_putnum(out, (long long) (est->seconds * 1000));
+        for (i = 0; i < 4; i++) {
+            out_puts(out, ",\"");
+            out_puts(out, name[i]);
+            out_puts(out, "\":{\"value\":");
+            out_putnum(out, llround(v[i]->value));
+            out_puts(out, ",\"low\":");
+            out_putnum(out, llround(v[i]->low));
+            out_puts(out, ",\"high\":");
+            out_putnum(out, llround(v[i]->high));
+            out_putc(out, '}');
+        }
+        out_puts(out, "}\n");
+        return;
+    }
+    out_printf(cli->out, "estimate of %lu probes (%lu directories, "
+            "%lu entries checked) in %.1f s\n", est->n_probes,
+            est->n_dirs, est->n_checked, est->seconds);
+    out_printf(cli->out, "%-10s %16s %16s %16s\n",
+            "TOTAL", "ESTIMATE", "LOW (95%)", "HIGH (95%)");
+    for (i = 0; i < 4; i++) {
+        out_printf(cli->out, "%-10s %16.0f %16.0f %16.0f\n", name[i],
+                v[i]->value, v[i]->low, v[i]->high);
+    }
+}
+
+void
+print_perm_object(struct out_s *out, mode_t mode)
 {
     unsigned char perm[11];
 
@@ -593,7 +798,7 @@ print_perm_object(mode_t mode)
     perm[7] = (S_IROTH & mode) ? 'r' : '-';
     perm[8] = (S_IWOTH & mode) ? 'w' : '-';
     perm[9] = (S_IXOTH & mode) ? 'x' : '-';
-    printf("%s  ", perm);
+    out_printf(out, "%s  ", perm);
 }
 
 unsigned char
@@ -605,151 +810,342 @@ object_have_suid_bit(mode_t mode, unsigned int flag, unsigned int flag_x)
 }
 
 void
-print_user_object(uid_t uid)
+print_user_object(struct out_s *out, uid_t uid)
 {
     struct passwd *pwd = NULL;
 
     pwd = getpwuid(uid);
     if (!pwd)
         return;
-    printf("%s ", pwd->pw_name);
+    out_printf(out, "%s ", pwd->pw_name);
 }
 
 void
-print_object_name(struct finfo_s *fi, struct opt_s *x)
+print_object_name(const struct sfile_result_s *res, struct cli_s *cli)
 {
-    size_t len;
     const char *color = EMPTY_STRING;
-    char buf[PATH_LEN];
-    char buf_path[PATH_LEN];
+    struct sfile_ctx_s *x = cli->x;
 
     if ((x->opts & O_FULL_PATH)) {
         /* bug: sfile -cPi string no color output ...
          * but for --ack or -cVi options color is ok
          * need call COLOR_NULL at end.
          */
-        printf("%s%s", fi->fi_path, COLOR_NULL);
+        out_printf(cli->out, "%s%s", res->path, COLOR_NULL);
         return;
     }
 
-    buf_path[0] = 0;
-    if (x->p_current_path && x->p_current_path[0]) {
-        len = strlen(x->p_current_path);
-        if (*(x->p_current_path + (len - 1)) != '/')
-            snprintf(buf_path, PATH_LEN_USE, "%s/", x->p_current_path);
-        else
-            strncpy(buf_path, x->p_current_path, PATH_LEN);
-    }
-
-    memset(buf, 0, PATH_LEN);
     if ((x->opts & O_COLOR)) {
-        if (fi->fi_type == TF_DIR)
+        if (res->type == TF_DIR)
             color = COLOR_DIR;
-        else if (fi->fi_type == TF_REG) {
-            if (!NEED_CUSTOM_OUTPUT(x) || !x->line.chunk)
+        else if (res->type == TF_REG) {
+            if (!NEED_CUSTOM_OUTPUT(x, res))
                 color = COLOR_REG_FILE;
         }
-        else if (fi->fi_type == TF_BACKUP)
+        else if (res->type == TF_BACKUP)
             color = COLOR_BACKUP;
-        else if (fi->fi_type == TF_ARCHIVE)
+        else if (res->type == TF_ARCHIVE)
             color = COLOR_ARCHIVE;
-
-        snprintf(buf, PATH_LEN_USE, "%s%s%s%s",
-                 color, buf_path, fi->fi_name, COLOR_NULL);
+        out_printf(cli->out, "%s%s%s ", color, res->path, COLOR_NULL);
     }
-    else {
-        if ((x->opts & O_FULL_PATH))
-            strncpy(buf, fi->fi_path, PATH_LEN);
-        else {
-            snprintf(buf, PATH_LEN_USE, "%s%s",
-                     buf_path, fi->fi_name);
-        }
-    }
-    printf("%s ", buf);
+    else
+        out_printf(cli->out, "%s ", res->path);
 }
 
 void
-print_line_object(struct stack_chunk_s *chunk, struct opt_s *x)
+print_line_object(struct stack_chunk_s *chunk,
+                  const struct sfile_result_s *res, struct cli_s *cli)
 {
-    struct stack_chunk_s *p_next = NULL;
+    int sep;
+    long last;
+    struct out_s *out = cli->out;
+    struct sfile_ctx_s *x = cli->x;
 
     if (LINE_S(chunk)) {
-        putchar('\n');
+        out_putc(out, '\n');
+        last = LINE_N(chunk);
         do {
-            p_next = chunk->next;
+            /* lines not contiguous with --before, --after */
+            if ((x->before_ctx || x->after_ctx) && LINE_N(chunk) > last + 1)
+                out_puts(out, " --\n");
+            last = LINE_N(chunk);
+            sep = LINE_CTX(chunk) ? '-' : '+';
             if (!(x->opts & O_NUM_LINE)) {
-                printf(" + %s\n", LINE_S(chunk));
+                out_printf(out, " %c %.*s\n", sep, (int) LINE_LEN(chunk),
+                       LINE_S(chunk));
             }
             else {
-                if (!NEED_CUSTOM_OUTPUT(x))
-                    printf(" [%ld] + %s\n", LINE_N(chunk), LINE_S(chunk));
+                if (!NEED_CUSTOM_OUTPUT(x, res))
+                    out_printf(out, " [%ld] %c %.*s\n", LINE_N(chunk), sep,
+                            (int) LINE_LEN(chunk), LINE_S(chunk));
                 else {
-                    printf(" [\x1b[1;36;44m\x1B[37m%ld%s] + %s\n",
-                           LINE_N(chunk), COLOR_NULL, LINE_S(chunk));
+                    out_printf(out, " [\x1b[1;36;44m\x1B[37m%ld%s] %c %.*s\n",
+                            LINE_N(chunk), COLOR_NULL, sep,
+                            (int) LINE_LEN(chunk), LINE_S(chunk));
                 }
             }
-            xfree(LINE_S(chunk));
-            xfree(chunk->un.data);
-            xfree(chunk);
-            chunk = p_next;
+            chunk = chunk->next;
         } while (chunk);
     }
-    else {
-        printf(" (line: %ld)\n", LINE_N(chunk));
-        xfree(chunk->un.data);
-        xfree(chunk);
+    else
+        out_printf(out, " (line: %ld)\n", LINE_N(chunk));
+}
+
+/*
+ * Write one JSON object by line:
+ * {"path":"...","type":"reg","inode":N,"size":N,"uid":N,"n_match":N,
+ *  "matches":[{"line":N,"offset":N,"text":"...","match":"..."}]}
+ * Context lines of --before and --after are in matches with
+ * "context":true and without "match".
+ */
+int
+print_json_object(const struct sfile_result_s *res, struct cli_s *cli)
+{
+    int ret;
+    size_t len;
+    struct out_s *out = cli->out;
+    struct stack_chunk_s *chunk = NULL;
+
+    ret = out_puts(out, "{\"path\":");
+    ret |= out_json_str(out, res->path, strlen(res->path));
+    ret |= out_puts(out, ",\"type\":\"");
+    ret |= out_puts(out, type_name[res->type]);
+    ret |= out_puts(out, "\",\"inode\":");
+    ret |= out_putnum(out, (long long) res->st->st_ino);
+    ret |= out_puts(out, ",\"size\":");
+    ret |= out_putnum(out, (long long) res->st->st_size);
+    ret |= out_puts(out, ",\"uid\":");
+    ret |= out_putnum(out, (long long) res->st->st_uid);
+    if (cli->x->wif) {
+        ret |= out_puts(out, ",\"n_match\":");
+        ret |= out_putnum(out, (long long) res->n_match);
+        ret |= out_puts(out, ",\"matches\":[");
+        for (chunk = res->lines; chunk; chunk = chunk->next) {
+            ret |= out_puts(out, "{\"line\":");
+            ret |= out_putnum(out, LINE_N(chunk));
+            ret |= out_puts(out, ",\"offset\":");
+            ret |= out_putnum(out, LINE_OFF(chunk));
+            if (LINE_CTX(chunk))
+                ret |= out_puts(out, ",\"context\":true");
+            if (LINE_S(chunk)) {
+                ret |= out_puts(out, ",\"text\":");
+                ret |= out_json_str(out, LINE_S(chunk), LINE_LEN(chunk));
+            }
+            if (LINE_S(chunk) && !LINE_CTX(chunk)) {
+                /* the match can go on the next lines */
+                len = LINE_LEN(chunk) - LINE_COL(chunk);
+                if (LINE_MLEN(chunk) < len)
+                    len = LINE_MLEN(chunk);
+                ret |= out_puts(out, ",\"match\":");
+                ret |= out_json_str(out, LINE_S(chunk) + LINE_COL(chunk), len);
+            }
+            ret |= out_putc(out, '}');
+            if (chunk->next)
+                ret |= out_putc(out, ',');
+        }
+        ret |= out_putc(out, ']');
     }
+    ret |= out_puts(out, "}\n");
+    return ret;
 }
 
-void *
-xmalloc(size_t size)
+void
+out_init(struct out_s *out, int fd)
 {
-    void *ptr = NULL;
+    out->fd = fd;
+    out->len = 0;
+}
 
-    if (!size)
-        size++;
-    ptr = malloc(size);
-    if (!ptr)
-        out_memory("malloc");
-    return ptr;
+int
+out_flush(struct out_s *out)
+{
+    size_t n;
+    ssize_t ret;
+
+    n = 0;
+    while (n < out->len) {
+        ret = write(out->fd, out->buf + n, out->len - n);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s:write: %s\n", program_name, strerror(errno));
+            out->len = 0;
+            return -1;
+        }
+        n += (size_t) ret;
+    }
+    out->len = 0;
+    return 0;
 }
 
-char *
-xstrdup(const char *str)
+int
+out_write(struct out_s *out, const char *str, size_t len)
 {
-    char *copy = NULL;
+    if (out->len + len > OUT_BUFSIZE) {
+        if (out_flush(out))
+            return -1;
+        /* too big for the buffer, write it directly */
+        if (len > OUT_BUFSIZE) {
+            memcpy(out->buf, str, OUT_BUFSIZE);
+            out->len = OUT_BUFSIZE;
+            return out_write(out, str + OUT_BUFSIZE, len - OUT_BUFSIZE);
+        }
+    }
+    memcpy(out->buf + out->len, str, len);
+    out->len += len;
+    return 0;
+}
 
-    copy = strdup(str);
-    if (!copy)
-        out_memory("strdup");
-    return copy;
+int
+out_puts(struct out_s *out, const char *str)
+{
+    return out_write(out, str, strlen(str));
 }
 
-void
-xfree(void *ptr)
+int
+out_putc(struct out_s *out, char c)
 {
-    if (ptr)
-        free(ptr);
+    if (out->len == OUT_BUFSIZE && out_flush(out))
+        return -1;
+    out->buf[out->len++] = c;
+    return 0;
 }
 
-void
-free_str_array(char **array)
+int
+out_putnum(struct out_s *out, long long n)
 {
-    int i;
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    unsigned long long u;
 
-    if (array) {
-        for (i = 0; array[i]; i++)
-            xfree(array[i]);
-        xfree(array);
+    u = (n < 0) ? (unsigned long long) -n : (unsigned long long) n;
+    do {
+        *--p = (char) ('0' + (u % 10));
+        u /= 10;
+    } while (u);
+    if (n < 0)
+        *--p = '-';
+    return out_write(out, p, (size_t) (buf + sizeof(buf) - p));
+}
+
+/* printf() in the buffer, flushed if the text does not fit */
+int
+out_printf(struct out_s *out, const char *fmt, ...)
+{
+    int n;
+    int ret;
+    char *buf = NULL;
+    va_list ap;
+
+    if (out->len == OUT_BUFSIZE && out_flush(out))
+        return -1;
+    va_start(ap, fmt);
+    n = vsnprintf(out->buf + out->len, OUT_BUFSIZE - out->len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return -1;
+    if ((size_t) n < OUT_BUFSIZE - out->len) {
+        out->len += (size_t) n;
+        return 0;
     }
+    buf = xmalloc((size_t) n + 1);
+    va_start(ap, fmt);
+    vsnprintf(buf, (size_t) n + 1, fmt, ap);
+    va_end(ap);
+    ret = out_write(out, buf, (size_t) n);
+    xfree(buf);
+    return ret;
 }
 
-void
-out_memory(const char *func_name)
+int
+out_json_str(struct out_s *out, const char *str, size_t len)
 {
-    fprintf(stderr, "%s:%s: memory exhausted\n",
-            program_name, func_name);
-    exit(EXIT_FAILURE);
+    static const char hex[] = "0123456789abcdef";
+    int ret;
+    size_t i;
+    size_t n;
+    size_t start;
+    unsigned char c;
+    char esc[6] = {'\\', 'u', '0', '0', 0, 0};
+
+    ret = out_putc(out, '"');
+    start = 0;
+    for (i = 0; i < len; i++) {
+        c = (unsigned char) str[i];
+        if (c >= 0x80 && (n = utf8_seq_len(str + i, len - i))) {
+            i += n - 1;
+            continue;
+        }
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\')
+            continue;
+        /* write the part without escape in one call */
+        ret |= out_write(out, str + start, i - start);
+        start = i + 1;
+        /* byte of an invalid UTF-8 sequence */
+        if (c >= 0x80)
+            ret |= out_puts(out, "\\ufffd");
+        else if (c == '"' || c == '\\') {
+            ret |= out_putc(out, '\\');
+            ret |= out_putc(out, (char) c);
+        }
+        else if (c == '\n')
+            ret |= out_write(out, "\\n", 2);
+        else if (c == '\t')
+            ret |= out_write(out, "\\t", 2);
+        else {
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            ret |= out_write(out, esc, sizeof(esc));
+        }
+    }
+    ret |= out_write(out, str + start, len - start);
+    ret |= out_putc(out, '"');
+    return ret;
+}
+
+/* length of the valid UTF-8 sequence at str (non ASCII), else 0 */
+size_t
+utf8_seq_len(const char *str, size_t len)
+{
+    size_t i;
+    size_t n;
+    unsigned char c;
+    unsigned char lo;
+    unsigned char hi;
+
+    c = (unsigned char) str[0];
+    lo = 0x80;
+    hi = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf)
+        n = 2;
+    else if (c >= 0xe0 && c <= 0xef) {
+        n = 3;
+        /* no overlong form, no surrogate */
+        if (c == 0xe0)
+            lo = 0xa0;
+        else if (c == 0xed)
+            hi = 0x9f;
+    }
+    else if (c >= 0xf0 && c <= 0xf4) {
+        n = 4;
+        /* no overlong form, not above U+10FFFF */
+        if (c == 0xf0)
+            lo = 0x90;
+        else if (c == 0xf4)
+            hi = 0x8f;
+    }
+    else
+        return 0;
+    if (len < n)
+        return 0;
+    for (i = 1; i < n; i++) {
+        c = (unsigned char) str[i];
+        if (c < lo || c > hi)
+            return 0;
+        lo = 0x80;
+        hi = 0xbf;
+    }
+    return n;
 }
 
 int
@@ -766,58 +1162,61 @@ xstrtol_fatal(const char *str, const char *err_msg)
     return ret;
 }
 
+double
+xstrtod_fatal(const char *str, const char *err_msg)
+{
+    double ret;
+    char *err = NULL;
+
+    ret = strtod(str, &err);
+    if (*err != '\0' || ret < 0) {
+        fprintf(stderr, "%s:strtod: %s\n", program_name, err_msg);
+        exit(EXIT_FAILURE);
+    }
+    return ret;
+}
+
+void *
+xmalloc(size_t size)
+{
+    void *ptr = NULL;
+
+    ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        fprintf(stderr, "%s:malloc: memory exhausted\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
 char *
-xstrcasestr(const char *str, const char *substr)
+xstrdup(const char *str)
 {
-    size_t len;
+    char *copy = NULL;
 
-    if (!str || !str[0] || !substr || !substr[0])
-        return NULL;
-    len = strlen(substr);
+    copy = xmalloc(strlen(str) + 1);
+    return strcpy(copy, str);
+}
 
-    do {
-        if (tolower(*str) == tolower(*substr) &&
-            !strncasecmp(str, substr, len)) {
-/* disable warning -Wcast-qual */
-#ifdef __GNUC__
-# pragma GCC diagnostic push
-# pragma GCC diagnostic ignored "-Wcast-qual"
-#endif
-            return (char *) str;
-#ifdef __GNUC__
-# pragma GCC diagnostic pop
-#endif
-        }
-        str++;
-    } while (*str);
-    return NULL;
+void
+xfree(void *ptr)
+{
+    if (ptr)
+        free(ptr);
 }
 
+/* sfile_parse_str_array(), exit if memory is exhausted */
 char **
-parse_str_array(const char *arg)
+xparse_str_array(const char *arg)
 {
-    int i;
-    char *copy = NULL;
-    char *ptr = NULL;
     char **array = NULL;
 
-    copy = xstrdup(arg);
-    i = 2; /* string + final NULL */
-    do {
-        if (*arg++ == ',')
-            i++;
-    } while (*arg);
-
-    array = xmalloc(((size_t) i) * sizeof(char *));
-    i = 0;
-    ptr = copy;
-    arg = strtok(ptr, ",");
-    while (arg) {
-        array[i++] = xstrdup(arg);
-        arg = strtok(NULL, ",");
-    }
-    xfree(copy);
-    array[i] = NULL;
+    array = sfile_parse_str_array(arg);
+    if (!array) {
+        fprintf(stderr, "%s:sfile_parse_str_array: memory exhausted\n",
+                program_name);
+        exit(EXIT_FAILURE);
+    }
     return array;
 }
 
@@ -829,6 +1228,7 @@ usage(void)
            "  -v, --version                   show program version and exit\n"
            "  -a, --all                       do not ignore entries starting with '.'\n"
            "  -w, --which                     search in directory to the $PATH varaible\n"
+           "                                  with -N stop at first result, unless -a\n"
            "  -r, --recursive                 list subdirectories recursively\n"
            "  -D, --ign-dir                   do not list entries is dir\n"
            "  -F, --ign-file                  do not list entries is regular file\n"
@@ -844,32 +1244,84 @@ usage(void)
            "                                  (just with -i argument)\n"
            "  -p, --print                     print first line to find word\n"
            "  -V, --print-all                 print all line to found word\n"
+           "      --after [N]                 print N lines after printed lines\n"
+           "      --before [N]                print N lines before printed lines\n"
+           "      --context [N]               print N lines before and after\n"
+           "                                  printed lines (-V if not -p)\n"
            "  -C, --ign-case                  ignore case distinctions in file name and word\n"
            "      --ign-case-in-file          ignore case distinctions to search word in file\n"
            "      --ign-case-file-name        ignore case distinctions in file name\n"
            "      --count                     count result for option --in-file\n"
-           "  -x, --exit [N]                  exit program after N result finds\n"
-           "  -o, --no-scan [STR]             do not list entries with STR in name\n"
-           "  -e, --extension [STR]           search file by extension\n"
-           "  -i, --in-file [STR]             search string to file\n"
-           "  -N, --name [STR]                search file to name exactly with STR\n"
-           "  -n, --in-name [STR]             if STR in the file name\n"
-           "  -u, --uid [UID]                 search file by UID\n"
-           "  -Q, --inode [INODE]             search file by inode numbers\n"
-           "      --ack [STR]                 like default ack program. (active options: -VlPrci)\n"
-           "                                    -V: Print all line where STRING (see option -i)\n"
-           "                                    -i: search word in file\n"
-           "                                    -l: Print line number\n"
-           "                                    -P: print full path\n"
-           "                                    -r: recusive\n"
-           "                                    -c: color\n",
+           "      --print0                    print path ending by a NUL character\n"
+           "      --json                      print one JSON object by result\n"
+           "      --files-from [FILE]         scan paths read in FILE (one by line),\n"
+           "                                  read standard input if FILE is -\n"
+           "      --null                      paths of --files-from end by a NUL character\n"
+           "  -j, --jobs [N]                  scan with N threads by device, results\n"
+           "                                  are not sorted\n"
+           "      --slow-jobs [N]             with -j, N threads by rotational disk or\n"
+           "                                  network file system (default 1 and 2)\n"
+           "      --one-file-system           do not descend in directories on other\n"
+           "                                  file systems\n"
+           "      --skip-fstype [TYPE,...]    do not descend in file systems of TYPE\n"
+           "                                  (nfs,fuse,proc,sysfs,tmpfs,cifs,...)\n"
+           "      --follow                    follow symbolic links\n",
            program_name, program_name);
+    fputs("      --inode-order               read directory and check entries in inode\n"
+          "                                  order (for hard disks)\n"
+          "      --summary[=DEPTH]           print totals (entries, types, size, allocated\n"
+          "                                  size, matches of --count) of the results by\n"
+          "                                  directory, to DEPTH below the scanned path (1)\n"
+          "      --estimate[=FRACTION|=TIME] print estimated totals (entries, size,\n"
+          "                                  results, matches) and their 95% interval,\n"
+          "                                  from random descents checking FRACTION\n"
+          "                                  of the entries (0.01, 1%) or during TIME\n"
+          "                                  by path (30s, 5m, 1h; 10s)\n"
+          "      --output [FILE]             print the results in FILE\n"
+          "      --queries [FILE]            check the queries of FILE (options of one\n"
+          "                                  query by line) in one scan, with the scan\n"
+          "                                  options (-r, -a, -j, ...) of the command line\n"
+          "      --trace [FILE]              write events of the scan in FILE\n"
+          "                                  (Chrome trace JSON format)\n"
+          "      --first-fast                check matching names and small files\n"
+          "                                  first, shallow directories first (-x)\n"
+          "      --cache-first               with -i, search files in page cache first,\n"
+          "                                  the others are read in background by\n"
+          "                                  --slow-jobs threads (4)\n"
+          "      --max-read-rate [MB]        read at most MB megabytes by second\n"
+          "      --max-iops [N]              at most N open, stat and read by second\n"
+          "      --max-cpu [PERCENT]         use at most PERCENT of one CPU\n"
+          "      --noatime                   do not update access time of read files\n"
+          "      --drop-cache                do not keep read files in page cache\n"
+          "      --shard [I/N]               check only entries of shard I (1 to N),\n"
+          "                                  by hash of the path below the scanned path\n"
+          "      --shard-depth [D]           with --shard, entries at depth D go to\n"
+          "                                  one shard with their subtree\n"
+          "  -x, --exit [N]                  exit program after N result finds\n"
+          "  -o, --no-scan [STR]             do not list entries with STR in name\n"
+          "  -e, --extension [STR]           search file by extension\n"
+          "  -i, --in-file [STR]             search string to file\n"
+          "  -N, --name [STR]                search file to name exactly with STR\n"
+          "  -n, --in-name [STR]             if STR in the file name\n"
+          "      --fuzzy-name [STR]          print names near of STR (edit distance),\n"
+          "                                  best first at the end of the scan\n"
+          "      --fuzzy-distance [N]        max edit distance of --fuzzy-name (2)\n"
+          "      --fuzzy-top [N]             print the N best names of --fuzzy-name (20)\n"
+          "  -u, --uid [UID]                 search file by UID\n"
+          "  -Q, --inode [INODE]             search file by inode numbers\n"
+          "      --ack [STR]                 like default ack program. (active options: -VlPrci)\n"
+          "                                    -V: Print all line where STRING (see option -i)\n"
+          "                                    -i: search word in file\n"
+          "                                    -l: Print line number\n"
+          "                                    -P: print full path\n"
+          "                                    -r: recusive\n"
+          "                                    -c: color\n", stdout);
     exit(EXIT_SUCCESS);
 }
 
 void
 version(void)
 {
-    puts("sfile version 1.4.0");
+    puts("sfile version 1.5.0");
     exit(EXIT_SUCCESS);
 }
@@ -24,25 +24,10 @@
 
 #include  <getopt.h>
 #include  <stdint.h>
-#include  <sys/types.h>
+#include  "libsfile.h"
 
 #define EMPTY_STRING "\0"
 
-#ifndef PATH_LEN
-# define PATH_LEN      1024
-# define PATH_LEN_USE  1023
-#else
-# define PATH_LEN_USE (PATH_LEN-1)
-#endif /* PATH_LEN */
-
-#ifndef LINE_BUFSIZE
-# define LINE_BUFSIZE 4096
-#endif /* !LINE_BUFSIZE */
-
-#ifndef ENV_VAR_PATH
-# define ENV_VAR_PATH "PATH"
-#endif /* !ENV_VAR_PATH */
-
 /* color list */
 #define COLOR_NULL          "\033[00m"
 #define COLOR_DIR           "\033[31m"
@@ -56,138 +41,66 @@ enum long_program_arguments {
     OPT_IGN_CASE_IN_FILE = 2,
     OPT_IGN_CASE_FILE_NAME = 3,
     OPT_WIF_COUNT = 4,
+    OPT_PRINT0 = 5,
+    OPT_JSON = 6,
+    OPT_FILES_FROM = 7,
+    OPT_NULL = 8,
+    OPT_ONE_FS = 9,
+    OPT_SKIP_FSTYPE = 10,
+    OPT_FOLLOW = 11,
+    OPT_INODE_ORDER = 12,
+    OPT_SLOW_JOBS = 13,
+    OPT_MAX_READ_RATE = 14,
+    OPT_MAX_IOPS = 15,
+    OPT_MAX_CPU = 16,
+    OPT_NOATIME = 17,
+    OPT_DROP_CACHE = 18,
+    OPT_SHARD = 19,
+    OPT_SHARD_DEPTH = 20,
+    OPT_FIRST_FAST = 21,
+    OPT_AFTER = 22,
+    OPT_BEFORE = 23,
+    OPT_CONTEXT = 24,
+    OPT_TRACE = 25,
+    OPT_FUZZY_NAME = 26,
+    OPT_FUZZY_DIST = 27,
+    OPT_FUZZY_TOP = 28,
+    OPT_OUTPUT = 29,
+    OPT_QUERIES = 30,
+    OPT_SUMMARY = 31,
+    OPT_CACHE_FIRST = 32,
+    OPT_ESTIMATE = 33,
 };
 
-#define STR_OPT_INDEX    "hvawrDFBAPcIlLpVCx:Q:u:o:e:i:N:n:G:"
-
-/* enumeration of all x->optq value */
-enum sfile_options_values {
-    /* default mode, just list file in current directory */
-    O_LS_MODE = 0x00000001,
-
-    /* list all object in directory */
-    O_ALL = 0x00000002,
-
-    /* search in dir to the $PATH variable */
-    O_ENV_PATH = 0x00000004,
-
-    /* set recursive mode */
-    O_RECURSIVE = 0x00000008,
-
-    /* ignore all directory */
-    O_IGN_DIR = 0x00000010,
-
-    /* ignore regular file */
-    O_IGN_FILE = 0x00000020,
-
-    /* ignore backup (file ending by ~) */
-    O_IGN_BACKUP = 0x00000040,
-
-    /* ignore archive */
-    O_IGN_ARCHIVE = 0x00000080,
-
-    /* print object full path */
-    O_FULL_PATH = 0x00000100,
-
-    /* color output */
-    O_COLOR = 0x00000200,
-
-    /* print inode to find object */
-    O_PUT_INODE = 0x00000400,
-
-    /* print number line to find word */
-    O_NUM_LINE = 0x00000800,
-
-    /* print file informations */
-    O_FILE_INFOS = 0x00001000,
-
-    /* print first line to find word */
-    O_PRINT = 0x00002000,
-
-    /* print all line to find word */
-    O_ALL_PRINT = 0x00004000,
-
-    /* Ignore case distinctions in file word */
-    O_IGN_CASE_IN_FILE = 0x00008000,
-
-    /* Ignore case distinctions in file name */
-    O_IGN_CASE_FILE_NAME = 0x00010000,
-
-    /* Count number result for word in file options */
-    O_WIF_COUNT = 0x00020000
-};
-
-/* append new chunk to stack */
-#define APPENDTOSTACK(stack, new)       \
-  do {                                  \
-      new->next = NULL;                 \
-      if (stack->chunk)                 \
-          stack->tail->next = new;      \
-      else                              \
-          stack->chunk = new;           \
-      stack->tail = new;                \
-    }  while (0)
+#define STR_OPT_INDEX    "hvawrDFBAPcIlLpVCx:Q:u:o:e:i:N:n:G:j:"
 
+#ifndef OUT_BUFSIZE
+# define OUT_BUFSIZE 65536
+#endif /* !OUT_BUFSIZE */
 
-#define NEED_CUSTOM_OUTPUT(x) ((x->opts & O_FULL_PATH) &&          \
+#define NEED_CUSTOM_OUTPUT(x, res) ((x->opts & O_FULL_PATH) &&    \
                                   (x->opts & O_COLOR) &&           \
-                                  x->line.chunk &&                 \
+                                  res->lines &&                    \
                                   ((x->opts & O_PRINT) ||          \
                                    (x->opts & O_ALL_PRINT)))
 
-enum file_type_e {
-    TF_REG,
-    TF_DIR,
-    TF_BACKUP,
-    TF_ARCHIVE,
-    TF_OTHER,
-    TF_ERROR,
-};
-
-struct line_s {
-    long n;
-    char *line;
-#define LINE_S(y)    ((struct line_s *) y->un.data)->line
-#define LINE_N(y)    ((struct line_s *) y->un.data)->n
+/* buffered writer for --print0 and --json output */
+struct out_s {
+    int fd;
+    size_t len;
+    char buf[OUT_BUFSIZE];
 };
 
-struct stack_chunk_s {
-    union {
-        void *data;
-        char *str;
-    } un;
-    struct stack_chunk_s *next;
-};
-
-struct stack_s {
-    struct stack_chunk_s *tail;
-    struct stack_chunk_s *chunk;
-};
-
-struct opt_s {
-    int n_exit;
-    int byuid;
-    int byino;
-    uint32_t opts;
-    unsigned long n_wif_result;
-    char *ext;
-    char *wif;   /* Word In File */
-    char *win;   /* Word In Name */
-    char *wnf;   /* Word Name File */
-    char *ign;
-    char **ign_ext;
-    char *p_current_path;
-    char *(*searchstring_wif)(const char *, const char *);
-    char *(*searchstring_win)(const char *, const char *);
-    int (*cmpstring_wnf)(const char *, const char *);
-    struct stack_s line;
-};
-
-struct finfo_s {
-    char fi_path[PATH_LEN];
-    const char *fi_name;
-    enum file_type_e fi_type;
-    struct stat fi_stat;
+struct cli_s {
+    struct sfile_ctx_s *x;
+    struct out_s *out;
+    FILE *stream;      /* --output FILE, written by out */
+    char *output;      /* --output FILE, else stdout */
+    char *files_from;  /* --files-from FILE, "-" for stdin */
+    int delim;         /* separator of --files-from paths */
+    char *queries;     /* --queries FILE, "-" for stdin */
+    struct cli_s *next;  /* queries of --queries */
+    unsigned long n_summary;  /* rows of --summary printed */
 };
 
 static struct option const opt_index[] =
@@ -222,46 +135,83 @@ static struct option const opt_index[] =
           {"uid",                required_argument, NULL, 'u'},
           {"inode",              required_argument, NULL, 'Q'},
           {"ack",                required_argument, NULL, OPT_ACK_LIKE},
+          {"print0",             no_argument,       NULL, OPT_PRINT0},
+          {"json",               no_argument,       NULL, OPT_JSON},
+          {"files-from",         required_argument, NULL, OPT_FILES_FROM},
+          {"null",               no_argument,       NULL, OPT_NULL},
+          {"jobs",               required_argument, NULL, 'j'},
+          {"one-file-system",    no_argument,       NULL, OPT_ONE_FS},
+          {"skip-fstype",        required_argument, NULL, OPT_SKIP_FSTYPE},
+          {"follow",             no_argument,       NULL, OPT_FOLLOW},
+          {"inode-order",        no_argument,       NULL, OPT_INODE_ORDER},
+          {"slow-jobs",          required_argument, NULL, OPT_SLOW_JOBS},
+          {"max-read-rate",      required_argument, NULL, OPT_MAX_READ_RATE},
+          {"max-iops",           required_argument, NULL, OPT_MAX_IOPS},
+          {"max-cpu",            required_argument, NULL, OPT_MAX_CPU},
+          {"noatime",            no_argument,       NULL, OPT_NOATIME},
+          {"drop-cache",         no_argument,       NULL, OPT_DROP_CACHE},
+          {"shard",              required_argument, NULL, OPT_SHARD},
+          {"shard-depth",        required_argument, NULL, OPT_SHARD_DEPTH},
+          {"first-fast",         no_argument,       NULL, OPT_FIRST_FAST},
+          {"after",              required_argument, NULL, OPT_AFTER},
+          {"before",             required_argument, NULL, OPT_BEFORE},
+          {"context",            required_argument, NULL, OPT_CONTEXT},
+          {"trace",              required_argument, NULL, OPT_TRACE},
+          {"fuzzy-name",         required_argument, NULL, OPT_FUZZY_NAME},
+          {"fuzzy-distance",     required_argument, NULL, OPT_FUZZY_DIST},
+          {"fuzzy-top",          required_argument, NULL, OPT_FUZZY_TOP},
+          {"output",             required_argument, NULL, OPT_OUTPUT},
+          {"queries",            required_argument, NULL, OPT_QUERIES},
+          {"summary",            optional_argument, NULL, OPT_SUMMARY},
+          {"cache-first",        no_argument,       NULL, OPT_CACHE_FIRST},
+          {"estimate",           optional_argument, NULL, OPT_ESTIMATE},
           {NULL,                 0,                 NULL, 0}
      };
 
-void sfile_init(struct opt_s *x);
-void sfile_free(struct opt_s *x);
 void set_program_name(const char *arg0);
-void decode_program_param(int argc, char **argv, struct opt_s *x);
-void scan_arg_object(int argc, char **argv, struct opt_s *x);
-void scan_path_environ(struct opt_s *x);
-void set_object_path(char *name, uint32_t full);
-int get_current_dir(char *current_path);
-enum file_type_e get_file_type(struct finfo_s *fi);
-int object_is_archive(const char *name);
-void list_dir_object(struct opt_s *x, const char *path);
-void check_object(struct opt_s *x, struct finfo_s *finfo);
-int ign_file_extension(const char *name, char **ext);
-int cmp_file_extension(const char *name, const char *ext);
-int word_in_file(struct opt_s *x, const char *path_file);
-void push_dir_stack(struct stack_s *stack, const char *path);
-void push_line_stack(struct stack_s *stack, uint32_t print,
-                     char *line, long n);
-void sfile_print_object(struct opt_s *x, struct finfo_s *fi);
-void print_perm_object(mode_t mode);
+void init_cli(struct cli_s *cli, struct sfile_ctx_s *x, struct out_s *out,
+              FILE *stream);
+void decode_program_param(int argc, char **argv, struct cli_s *cli);
+void parse_estimate(struct sfile_ctx_s *x, const char *arg);
+void open_output(struct cli_s *cli);
+void close_output(struct cli_s *cli);
+void read_queries(struct cli_s *cli);
+int query_scan_options(const struct sfile_ctx_s *x);
+char **split_query_line(const char *line, int *argc, char **buf);
+void free_queries(struct cli_s *cli);
+void scan_arg_object(int argc, char **argv, struct cli_s *cli);
+void scan_files_from(struct cli_s *cli);
+sfile_result_cb select_print_object(const struct sfile_ctx_s *x);
+int print_path_object(const struct sfile_result_s *res, void *data);
+int sfile_print_object(const struct sfile_result_s *res, void *data);
+int print_summary_object(const struct sfile_summary_s *sum, void *data);
+void print_estimate_object(const struct sfile_estimate_s *est, void *data);
+void print_perm_object(struct out_s *out, mode_t mode);
 unsigned char object_have_suid_bit(mode_t mode, unsigned int flag, unsigned int flag_x);
-void print_user_object(uid_t uid);
-void print_object_name(struct finfo_s *fi, struct opt_s *x);
-void print_line_object(struct stack_chunk_s *chunk, struct opt_s *x);
+void print_user_object(struct out_s *out, uid_t uid);
+void print_object_name(const struct sfile_result_s *res,
+                       struct cli_s *cli);
+void print_line_object(struct stack_chunk_s *chunk,
+                       const struct sfile_result_s *res,
+                       struct cli_s *cli);
+int print_json_object(const struct sfile_result_s *res, struct cli_s *cli);
+void out_init(struct out_s *out, int fd);
+int out_flush(struct out_s *out);
+int out_write(struct out_s *out, const char *str, size_t len);
+int out_puts(struct out_s *out, const char *str);
+int out_putc(struct out_s *out, char c);
+int out_putnum(struct out_s *out, long long n);
+int out_printf(struct out_s *out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int out_json_str(struct out_s *out, const char *str, size_t len);
+size_t utf8_seq_len(const char *str, size_t len);
+int xstrtol_fatal(const char *str, const char *err_msg);
+double xstrtod_fatal(const char *str, const char *err_msg);
 void *xmalloc(size_t size);
 char *xstrdup(const char *str);
 void xfree(void *ptr);
-void free_str_array(char **array);
-void out_memory(const char *func_name) __attribute__((noreturn));
-int xstrtol_fatal(const char *str, const char *err_msg);
-char *xstrcasestr(const char *str, const char *substr);
-char **parse_str_array(const char *arg);
+char **xparse_str_array(const char *arg);
 void usage(void) __attribute__((noreturn));
 void version(void) __attribute__((noreturn));
 
-/*  list archive extension */
-const char *tab_archive[] =
-     {".gz", ".bz2", ".zip", ".rar", ".7z", NULL};
-
 #endif /* not have SFILE_H */